@@ -1,17 +1,17 @@
 #include "wrapper.h"
 #include <stdint.h>
-#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-uint8_t SCREEN[32][64];
-uint8_t * i;
-uint8_t v[16];
+uint64_t SCREEN[32];
+uint32_t DIRTY;
+uint8_t * I;
+uint8_t V[16];
 #define STACK_DEPTH 16
-jmp_buf stack[STACK_DEPTH];
+void * stack[STACK_DEPTH];
 uint8_t sp = 0;
-uint8_t TIMER_DELAY = 0;
-uint8_t TIMER_SOUND = 0;
+uint32_t RNG = 1;
 
 static const unsigned char FONT[0x10 * 5] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -33,7 +33,15 @@ static const unsigned char FONT[0x10 * 5] = {
 };
 
 // helper functions
-static const uint8_t plot(uint8_t x, uint8_t y, uint8_t height) {
+// CXNN generator: xorshift32, as in the interpreter
+static uint8_t rnd() {
+  RNG ^= RNG << 13;
+  RNG ^= RNG >> 17;
+  RNG ^= RNG << 5;
+  return RNG >> 24;
+}
+
+static const uint8_t plot(const uint8_t * i, uint8_t x, uint8_t y, uint8_t height) {
   uint8_t collision = 0;
 
   y %= 32;
@@ -41,252 +49,324 @@ static const uint8_t plot(uint8_t x, uint8_t y, uint8_t height) {
 
   if (y + height > 32) height = 32 - y;
   for (uint8_t row = 0; row < height; row ++) {
-    uint8_t width = 8;
-    if (x + width > 64) width = 64 - x;
-    for (uint8_t col = 0; col < width; col ++) {
-      if (*(i + row) & (0x80 >> col)) {
-        uint8_t p = ! SCREEN[y + row][x + col];
-        SCREEN[y + row][x + col] = p;
-        screen_set(x + col, y + row, p);
-        if ( ! p) collision = 1;
-      }
-    }
+    // sprite bits past the right edge are shifted out
+    uint64_t sprite = ((uint64_t) *(i + row) << 56) >> x;
+    if (SCREEN[y + row] & sprite) collision = 1;
+    SCREEN[y + row] ^= sprite;
+    if (sprite) DIRTY |= (uint32_t) 1 << (y + row);
   }
 
-  screen_update();
+  screen_update(SCREEN, DIRTY);
+  DIRTY = 0;
 
   return collision;
 }
 
-static void clear() {
-  memset(SCREEN, 0, 64 * 32);
-  screen_clear();
-}
-
 uint8_t ram_2cd[] = { 0x7c, 0xfe, 0x7c, 0x60, 0xf0, 0x60, 0x40, 0xe0, 0xa0, 0xf8 };
 uint8_t ram_2f8[] = { 0x00, 0x00, 0x00 };
+static void sub_2a2();
+static void sub_2ac();
+static void sub_2b6();
+static void sub_2d8();
+
+static void sub_2a2() {
+ uint8_t v7 = V[0x7];
+ uint8_t * i = I;
+lbl_2a2:
+	i = ram_2f8 + 0x000;
+lbl_2a4:
+	{ unsigned char value = v7;
+*(i + 2) = value % 10; value /= 10;
+*(i + 1) = value % 10; *i = value / 10;}
+lbl_2a6:
+	V[0x3] = 0x00;
+lbl_2a8:
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); sp = STACK_DEPTH + 1; return; }
+	I = i;
+	sp ++; sub_2b6();
+	sp --;
+	i = I;
+lbl_2aa:
+	V[0x7] = v7; I = i;
+	return;
+}
+
+static void sub_2ac() {
+ uint8_t v8 = V[0x8];
+ uint8_t * i = I;
+lbl_2ac:
+	i = ram_2f8 + 0x000;
+lbl_2ae:
+	{ unsigned char value = v8;
+*(i + 2) = value % 10; value /= 10;
+*(i + 1) = value % 10; *i = value / 10;}
+lbl_2b0:
+	V[0x3] = 0x32;
+lbl_2b2:
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); sp = STACK_DEPTH + 1; return; }
+	I = i;
+	sp ++; sub_2b6();
+	sp --;
+	i = I;
+lbl_2b4:
+	V[0x8] = v8; I = i;
+	return;
+}
+
+static void sub_2b6() {
+ uint8_t v0 = V[0x0];
+ uint8_t v1 = V[0x1];
+ uint8_t v2 = V[0x2];
+ uint8_t v3 = V[0x3];
+ uint8_t * i = I;
+lbl_2b6:
+	V[0xd] = 0x1b;
+lbl_2b8:
+	v0 = i[0x0]; v1 = i[0x1]; v2 = i[0x2]; i += 0x03;
+lbl_2ba:
+	i = (uint8_t *) & FONT[5 * (v0 & 0xF)];
+lbl_2bc:
+	V[0xf] = plot(i, v3, 0x1b, 0x05);
+lbl_2be:
+	v3 = v3 + 0x05;
+lbl_2c0:
+	i = (uint8_t *) & FONT[5 * (v1 & 0xF)];
+lbl_2c2:
+	V[0xf] = plot(i, v3, 0x1b, 0x05);
+lbl_2c4:
+	v3 = v3 + 0x05;
+lbl_2c6:
+	i = (uint8_t *) & FONT[5 * (v2 & 0xF)];
+lbl_2c8:
+	V[0xf] = plot(i, v3, 0x1b, 0x05);
+lbl_2ca:
+	V[0x0] = v0; V[0x1] = v1; V[0x2] = v2; V[0x3] = v3; I = i;
+	return;
+}
+
+static void sub_2d8() {
+lbl_2d8:
+	V[0xe] = 0x01;
+lbl_2da:
+	V[0xd] = 0x10;
+lbl_2dc:
+	set_timer_sound(0x10);
+lbl_2de:
+	return;
+}
+
 void run() {
- clear();
+ uint8_t v4 = V[0x4];
+ uint8_t v5 = V[0x5];
+ uint8_t v6 = V[0x6];
+ uint8_t v7 = V[0x7];
+ uint8_t v8 = V[0x8];
+ uint8_t v9 = V[0x9];
+ uint8_t vb = V[0xb];
+ uint8_t vd = V[0xd];
+ uint8_t ve = V[0xe];
+ uint8_t vf = V[0xf];
+ uint8_t * i = I;
+ DIRTY = 0xFFFFFFFF;
 lbl_200:
 	i = ram_2cd + 0x000;
 lbl_202:
-	v[0x09] = 0x38;
+	v9 = 0x38;
 lbl_204:
-	v[0x0a] = 0x08;
+	V[0xa] = 0x08;
 lbl_206:
-	v[0xF] = plot(v[0x9], v[0xa], 0x03);
+	vf = plot(i, 0x38, 0x08, 0x03);
 lbl_208:
 	i = ram_2cd + 0x003;
 lbl_20a:
-	v[0x0b] = 0x00;
+	vb = 0x00;
 lbl_20c:
-	v[0x0c] = 0x03;
+	V[0xc] = 0x03;
 lbl_20e:
-	v[0xF] = plot(v[0xb], v[0xc], 0x03);
+	vf = plot(i, 0x00, 0x03, 0x03);
 lbl_210:
 	i = ram_2cd + 0x009;
 lbl_212:
-	v[0x04] = 0x1d;
+	v4 = 0x1d;
 lbl_214:
-	v[0x05] = 0x1f;
+	v5 = 0x1f;
 lbl_216:
-	v[0xF] = plot(v[0x4], v[0x5], 0x01);
+	vf = plot(i, 0x1d, 0x1f, 0x01);
 lbl_218:
-	v[0x07] = 0x00;
+	v7 = 0x00;
 lbl_21a:
-	v[0x08] = 0x0f;
+	v8 = 0x0f;
 lbl_21c:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2a2; } else sp --;
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; }
+	V[0x7] = v7; V[0xd] = vd; V[0xf] = vf; I = i;
+	sp ++; sub_2a2();
+	if (sp > STACK_DEPTH) return;
+	sp --;
+	v7 = V[0x7]; vd = V[0xd]; vf = V[0xf]; i = I;
 lbl_21e:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2ac; } else sp --;
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; }
+	V[0x8] = v8; V[0xd] = vd; V[0xf] = vf; I = i;
+	sp ++; sub_2ac();
+	if (sp > STACK_DEPTH) return;
+	sp --;
+	v8 = V[0x8]; vd = V[0xd]; vf = V[0xf]; i = I;
 lbl_220:
-	if (v[0x08] != 0x00) goto lbl_224;
+	if (v8 != 0x00) goto lbl_224;
 lbl_222:
 	return;
 lbl_224:
-	v[0x04] = 0x1e;
+	v4 = 0x1e;
 lbl_226:
-	v[0x05] = 0x1c;
+	v5 = 0x1c;
 lbl_228:
 	i = ram_2cd + 0x006;
 lbl_22a:
-	v[0xF] = plot(v[0x4], v[0x5], 0x03);
+	vf = plot(i, 0x1e, 0x1c, 0x03);
 lbl_22c:
-	v[0x0e] = 0x00;
+	ve = 0x00;
 lbl_22e:
-	v[0x06] = 0x80;
+	v6 = 0x80;
 lbl_230:
-	v[0x0d] = 0x04;
+	vd = 0x04;
 lbl_232:
-	if (! check_key(v[0x0d])) goto lbl_236;
+	if (! check_key(0x04)) goto lbl_236;
 lbl_234:
-	v[0x06] = 0xff;
+	v6 = 0xff;
 lbl_236:
-	v[0x0d] = 0x05;
+	vd = 0x05;
 lbl_238:
-	if (! check_key(v[0x0d])) goto lbl_23c;
+	if (! check_key(0x05)) goto lbl_23c;
 lbl_23a:
-	v[0x06] = 0x00;
+	v6 = 0x00;
 lbl_23c:
-	v[0x0d] = 0x06;
+	vd = 0x06;
 lbl_23e:
-	if (! check_key(v[0x0d])) goto lbl_242;
+	if (! check_key(0x06)) goto lbl_242;
 lbl_240:
-	v[0x06] = 0x01;
+	v6 = 0x01;
 lbl_242:
-	if (v[0x06] == 0x80) goto lbl_246;
+	if (v6 == 0x80) goto lbl_246;
 lbl_244:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2d8; } else sp --;
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; }
+	V[0xd] = vd; V[0xe] = ve;
+	sp ++; sub_2d8();
+	sp --;
+	vd = V[0xd]; ve = V[0xe];
 lbl_246:
 	i = ram_2cd + 0x003;
 lbl_248:
-	v[0xF] = plot(v[0xb], v[0xc], 0x03);
+	vf = plot(i, vb, 0x03, 0x03);
 lbl_24a:
-	v[0x0d] = rand() & 0x01;
+	vd = rnd() & 0x01;
 lbl_24c:
-	{ uint16_t result = v[0x0b] + v[0x0d];
-	v[0x0b] = result;
-v[0xF] = (result > 255 ? 1 : 0);}
+	{ uint16_t result = vb + vd;
+	vb = result;
+vf = (result > 255 ? 1 : 0);}
 lbl_24e:
-	v[0xF] = plot(v[0xb], v[0xc], 0x03);
+	vf = plot(i, vb, 0x03, 0x03);
 lbl_250:
-	if (v[0x0f] == 0x00) goto lbl_254;
+	if (vf == 0x00) goto lbl_254;
 lbl_252:
 	goto lbl_292;
 lbl_254:
 	i = ram_2cd + 0x000;
 lbl_256:
-	v[0xF] = plot(v[0x9], v[0xa], 0x03);
+	vf = plot(i, v9, 0x08, 0x03);
 lbl_258:
-	v[0x0d] = rand() & 0x01;
+	vd = rnd() & 0x01;
 lbl_25a:
-	if (v[0x0d] == 0x00) goto lbl_25e;
+	if (vd == 0x00) goto lbl_25e;
 lbl_25c:
-	v[0x0d] = 0xff;
+	vd = 0xff;
 lbl_25e:
-	v[0x09] += 0xfe;
+	v9 = v9 + 0xfe;
 lbl_260:
-	v[0xF] = plot(v[0x9], v[0xa], 0x03);
+	vf = plot(i, v9, 0x08, 0x03);
 lbl_262:
-	if (v[0x0f] == 0x00) goto lbl_266;
+	if (vf == 0x00) goto lbl_266;
 lbl_264:
 	goto lbl_28c;
 lbl_266:
-	if (v[0x0e] != 0x00) goto lbl_26a;
+	if (ve != 0x00) goto lbl_26a;
 lbl_268:
 	goto lbl_22e;
 lbl_26a:
 	i = ram_2cd + 0x006;
 lbl_26c:
-	v[0xF] = plot(v[0x4], v[0x5], 0x03);
+	vf = plot(i, v4, v5, 0x03);
 lbl_26e:
-	if (v[0x05] != 0x00) goto lbl_272;
+	if (v5 != 0x00) goto lbl_272;
 lbl_270:
 	goto lbl_286;
 lbl_272:
-	v[0x05] += 0xff;
+	v5 = v5 + 0xff;
 lbl_274:
-	{ uint16_t result = v[0x04] + v[0x06];
-	v[0x04] = result;
-v[0xF] = (result > 255 ? 1 : 0);}
+	{ uint16_t result = v4 + v6;
+	v4 = result;
+vf = (result > 255 ? 1 : 0);}
 lbl_276:
-	v[0xF] = plot(v[0x4], v[0x5], 0x03);
+	vf = plot(i, v4, v5, 0x03);
 lbl_278:
-	if (v[0x0f] == 0x01) goto lbl_27c;
+	if (vf == 0x01) goto lbl_27c;
 lbl_27a:
 	goto lbl_246;
 lbl_27c:
-	v[0x0d] = 0x08;
+	vd = 0x08;
 lbl_27e:
-	v[0x0d] &= v[0x05];
-	v[0xF] = 0;
+	vd = 0x08 & v5;
+	vf = 0;
 lbl_280:
-	if (v[0x0d] != 0x08) goto lbl_284;
+	if (vd != 0x08) goto lbl_284;
 lbl_282:
 	goto lbl_28c;
 lbl_284:
 	goto lbl_292;
 lbl_286:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2ac; } else sp --;
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; }
+	V[0x8] = v8; V[0xd] = vd; V[0xf] = vf; I = i;
+	sp ++; sub_2ac();
+	if (sp > STACK_DEPTH) return;
+	sp --;
+	v8 = V[0x8]; vd = V[0xd]; vf = V[0xf]; i = I;
 lbl_288:
-	v[0x08] += 0xff;
+	v8 = v8 + 0xff;
 lbl_28a:
 	goto lbl_21e;
 lbl_28c:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2a2; } else sp --;
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; }
+	V[0x7] = v7; V[0xd] = vd; V[0xf] = vf; I = i;
+	sp ++; sub_2a2();
+	if (sp > STACK_DEPTH) return;
+	sp --;
+	v7 = V[0x7]; vd = V[0xd]; vf = V[0xf]; i = I;
 lbl_28e:
-	v[0x07] += 0x05;
+	v7 = v7 + 0x05;
 lbl_290:
 	goto lbl_296;
 lbl_292:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2a2; } else sp --;
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; }
+	V[0x7] = v7; V[0xd] = vd; V[0xf] = vf; I = i;
+	sp ++; sub_2a2();
+	if (sp > STACK_DEPTH) return;
+	sp --;
+	v7 = V[0x7]; vd = V[0xd]; vf = V[0xf]; i = I;
 lbl_294:
-	v[0x07] += 0x0f;
+	v7 = v7 + 0x0f;
 lbl_296:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2a2; } else sp --;
+	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; }
+	V[0x7] = v7; V[0xd] = vd; V[0xf] = vf; I = i;
+	sp ++; sub_2a2();
+	if (sp > STACK_DEPTH) return;
+	sp --;
+	v7 = V[0x7]; vd = V[0xd]; vf = V[0xf]; i = I;
 lbl_298:
-	v[0x0d] = 0x03;
+	vd = 0x03;
 lbl_29a:
-	TIMER_SOUND = v[0x0d];
+	set_timer_sound(0x03);
 lbl_29c:
 	i = ram_2cd + 0x006;
 lbl_29e:
-	v[0xF] = plot(v[0x4], v[0x5], 0x03);
+	vf = plot(i, v4, v5, 0x03);
 lbl_2a0:
 	goto lbl_286;
-lbl_2a2:
-	i = ram_2f8 + 0x000;
-lbl_2a4:
-	{ unsigned char value = v[0x07];
-*(i + 2) = value % 10; value /= 10;
-*(i + 1) = value % 10; *i = value / 10;}
-lbl_2a6:
-	v[0x03] = 0x00;
-lbl_2a8:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2b6; } else sp --;
-lbl_2aa:
-	if (sp == 0) { puts("Stack underflow"); return; } longjmp(stack[sp - 1], 1);
-lbl_2ac:
-	i = ram_2f8 + 0x000;
-lbl_2ae:
-	{ unsigned char value = v[0x08];
-*(i + 2) = value % 10; value /= 10;
-*(i + 1) = value % 10; *i = value / 10;}
-lbl_2b0:
-	v[0x03] = 0x32;
-lbl_2b2:
-	if (sp == STACK_DEPTH) { puts("Stack overflow"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_2b6; } else sp --;
-lbl_2b4:
-	if (sp == 0) { puts("Stack underflow"); return; } longjmp(stack[sp - 1], 1);
-lbl_2b6:
-	v[0x0d] = 0x1b;
-lbl_2b8:
-	for (unsigned char j = 0; j <= 0x02; j ++, i ++)
-		v[j] = *i;
-lbl_2ba:
-	i = & FONT[5 * (v[0x00] & 0xF)];
-lbl_2bc:
-	v[0xF] = plot(v[0x3], v[0xd], 0x05);
-lbl_2be:
-	v[0x03] += 0x05;
-lbl_2c0:
-	i = & FONT[5 * (v[0x01] & 0xF)];
-lbl_2c2:
-	v[0xF] = plot(v[0x3], v[0xd], 0x05);
-lbl_2c4:
-	v[0x03] += 0x05;
-lbl_2c6:
-	i = & FONT[5 * (v[0x02] & 0xF)];
-lbl_2c8:
-	v[0xF] = plot(v[0x3], v[0xd], 0x05);
-lbl_2ca:
-	if (sp == 0) { puts("Stack underflow"); return; } longjmp(stack[sp - 1], 1);
-lbl_2d8:
-	v[0x0e] = 0x01;
-lbl_2da:
-	v[0x0d] = 0x10;
-lbl_2dc:
-	TIMER_SOUND = v[0x0d];
-lbl_2de:
-	if (sp == 0) { puts("Stack underflow"); return; } longjmp(stack[sp - 1], 1);
 }
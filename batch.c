@@ -0,0 +1,398 @@
+// Batch runner: many independent CHIP-8 machines on all cores
+//  reads a job list, runs every job headless for a fixed number of frames on
+//  a work-stealing thread pool, and writes one result line per job
+//
+// Job list: one job per line, "rom.ch8 [seed [script]]"
+//  blank lines and lines starting with # are ignored
+//  see script.h for the input script format
+//
+// Results: one line per job, in job list order
+//  "rom seed screen-hash cycles error", error 0 for none, -1 if the job
+//  could not be set up
+//
+// With -l lanes, runs of consecutive jobs on the same ROM share a lockstep
+//  engine (see lockstep.h) of up to that many lanes
+#include "interp.h"
+#include "lockstep.h"
+#include "script.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct job {
+    // input
+    char * rom;
+    unsigned int seed;  // seeds CXNN
+    char * script;
+
+    // output
+    uint64_t hash;
+    unsigned long cycles;
+    int error;
+};
+
+struct job * jobs = NULL;
+unsigned int job_count = 0;
+
+// jobs are handed out in units: a single job, or with -l a run of jobs
+//  on the same ROM
+struct unit {
+    unsigned int first;
+    unsigned int count;
+};
+
+struct unit * units = NULL;
+unsigned int unit_count = 0;
+
+// run options, same frame as headless / chip8-curses
+unsigned long frames = 600;
+unsigned int cycles = 100;
+unsigned int lanes = 0;
+unsigned int jit = 0;
+
+// the machines keep their own timers, each job's input script supplies keys
+unsigned char cb_check_key(void * ctx, unsigned char value) {
+    return ((struct input *) ctx)->keys[value];
+}
+
+unsigned char cb_await_key(void * ctx) {
+    return input_next_key(ctx);
+}
+
+static const struct chip8_callbacks callbacks = {
+    .check_key = cb_check_key,
+    .await_key = cb_await_key
+};
+
+// read a ROM, returning its size or -1 on error
+static int load_rom(const char * filename, unsigned char prog[4096])
+{
+    FILE * f = fopen(filename, "rb");
+    if (! f) {
+        perror(filename);
+        return -1;
+    }
+    unsigned int size = fread(prog, 1, 4096, f);
+    fclose(f);
+    return size;
+}
+
+// runs one job to completion on the calling thread
+static void run_job(struct job * job)
+{
+    job->hash = 0;
+    job->cycles = 0;
+    job->error = -1;
+
+    struct script script = {};
+    if (job->script && script_load(&script, job->script))
+        return;
+
+    unsigned char prog[4096];
+    int size = load_rom(job->rom, prog);
+    if (size < 0) {
+        script_free(&script);
+        return;
+    }
+
+    struct input input;
+    input_init(&input, &script);
+
+    struct machine * m = chip8_create(&callbacks, &input);
+    if (jit) chip8_jit(m);
+    chip8_seed(m, job->seed);
+    if (chip8_load(m, prog, size)) {
+        fprintf(stderr, "%s: ROM too large\n", job->rom);
+        chip8_destroy(m);
+        script_free(&script);
+        return;
+    }
+
+    for (unsigned long frame = 0; frame < frames; frame ++) {
+        input_poll(&input, frame);
+        if (chip8_run(m, cycles, CHIP8_STOP_DRAW | CHIP8_STOP_KEY) & CHIP8_STOP_ERROR)
+            break;
+        chip8_tick(m);
+    }
+
+    const uint64_t * screen;
+    chip8_present(m, &screen);
+    job->hash = hash_screen(screen);
+    job->cycles = chip8_cycles(m);
+    job->error = chip8_error(m);
+
+    chip8_destroy(m);
+    script_free(&script);
+}
+
+// FX0A for a lockstep lane: ctx is the array of per-job inputs
+unsigned char cb_lane_await_key(void * ctx, unsigned int lane) {
+    return input_next_key(&((struct input *) ctx)[lane]);
+}
+
+// runs count jobs on the same ROM, as the lanes of one lockstep engine
+static void run_lockstep(struct job * job, unsigned int count)
+{
+    for (unsigned int l = 0; l < count; l ++) {
+        job[l].hash = 0;
+        job[l].cycles = 0;
+        job[l].error = -1;
+    }
+
+    unsigned char prog[4096];
+    int size = load_rom(job[0].rom, prog);
+    if (size < 0)
+        return;
+
+    // a lane whose script fails to load still runs, with no input, so the
+    //  others keep their place; it is reported as failed at the end
+    struct script * scripts = calloc(count, sizeof(struct script));
+    struct input * inputs = calloc(count, sizeof(struct input));
+    unsigned char * bad = calloc(count, 1);
+
+    struct lockstep * ls = lockstep_create(count, cb_lane_await_key, inputs);
+    if (lockstep_load(ls, prog, size)) {
+        fprintf(stderr, "%s: ROM too large\n", job[0].rom);
+        count = 0;
+    }
+    for (unsigned int l = 0; l < count; l ++) {
+        if (job[l].script && script_load(&scripts[l], job[l].script))
+            bad[l] = 1;
+        input_init(&inputs[l], &scripts[l]);
+        lockstep_seed(ls, l, job[l].seed);
+    }
+
+    for (unsigned long frame = 0; frame < frames && count; frame ++) {
+        for (unsigned int l = 0; l < count; l ++) {
+            input_poll(&inputs[l], frame);
+            for (int k = 0; k < 16; k ++)
+                lockstep_set_key(ls, l, k, inputs[l].keys[k] != 0);
+        }
+        if (! lockstep_run(ls, cycles, CHIP8_STOP_DRAW | CHIP8_STOP_KEY))
+            break;
+        lockstep_tick(ls);
+    }
+
+    for (unsigned int l = 0; l < count; l ++) {
+        if (! bad[l]) {
+            const uint64_t * screen;
+            lockstep_present(ls, l, &screen);
+            job[l].hash = hash_screen(screen);
+            job[l].cycles = lockstep_cycles(ls, l);
+            job[l].error = lockstep_error(ls, l);
+        }
+        script_free(&scripts[l]);
+    }
+
+    lockstep_destroy(ls);
+    free(bad);
+    free(inputs);
+    free(scripts);
+}
+
+static void run_unit(const struct unit * unit)
+{
+    if (lanes)
+        run_lockstep(&jobs[unit->first], unit->count);
+    else
+        run_job(&jobs[unit->first]);
+}
+
+// work-stealing pool
+//  every worker owns a contiguous range [head, tail) of the unit list and
+//  takes units from its head; a worker that runs dry steals the back half
+//  of another worker's range
+struct worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    unsigned int head;
+    unsigned int tail;
+};
+
+struct worker * workers = NULL;
+unsigned int worker_count = 0;
+
+// take the next unit from our own range
+static int take_unit(struct worker * w, unsigned int * unit)
+{
+    int found = 0;
+    pthread_mutex_lock(&w->lock);
+    if (w->head < w->tail) {
+        *unit = w->head ++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+// refill our (empty) range from the back half of someone else's
+static int steal_units(struct worker * w)
+{
+    unsigned int self = w - workers;
+    for (unsigned int i = 1; i < worker_count; i ++) {
+        struct worker * victim = &workers[(self + i) % worker_count];
+
+        pthread_mutex_lock(&victim->lock);
+        unsigned int left = victim->tail - victim->head;
+        if (left == 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        unsigned int tail = victim->tail;
+        unsigned int mid = tail - (left + 1) / 2;
+        victim->tail = mid;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&w->lock);
+        w->head = mid;
+        w->tail = tail;
+        pthread_mutex_unlock(&w->lock);
+        return 1;
+    }
+    return 0;
+}
+
+static void * worker_main(void * arg)
+{
+    struct worker * w = arg;
+    unsigned int unit;
+
+    // no new units ever appear, so once nothing is left to steal we are done
+    do {
+        while (take_unit(w, &unit))
+            run_unit(&units[unit]);
+    } while (steal_units(w));
+
+    return NULL;
+}
+
+// read the job list
+static int load_jobs(const char * filename)
+{
+    FILE * f = fopen(filename, "r");
+    if (! f) {
+        perror(filename);
+        return 1;
+    }
+
+    char line[4096];
+    unsigned int size = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char rom[4096], script[4096];
+        unsigned int seed = 1;
+        int fields = sscanf(line, "%4095s %u %4095s", rom, &seed, script);
+        if (fields < 1 || rom[0] == '#')
+            continue;
+
+        if (job_count == size) {
+            size = (size ? size * 2 : 256);
+            jobs = realloc(jobs, size * sizeof(struct job));
+        }
+        jobs[job_count].rom = strdup(rom);
+        jobs[job_count].seed = seed;
+        jobs[job_count].script = (fields > 2 ? strdup(script) : NULL);
+        job_count ++;
+    }
+    fclose(f);
+    return 0;
+}
+
+// split the job list into units
+static void make_units(void)
+{
+    units = malloc((job_count ? job_count : 1) * sizeof(struct unit));
+    for (unsigned int i = 0; i < job_count; i ++) {
+        struct unit * last = (unit_count ? &units[unit_count - 1] : NULL);
+        if (lanes && last && last->count < lanes && ! strcmp(jobs[last->first].rom, jobs[i].rom)) {
+            last->count ++;
+        } else {
+            units[unit_count].first = i;
+            units[unit_count].count = 1;
+            unit_count ++;
+        }
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    const char * output = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:j:l:o:J")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            cycles = strtoul(optarg, NULL, 0);
+            break;
+        case 'j':
+            threads = strtol(optarg, NULL, 0);
+            break;
+        case 'l':
+            lanes = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'J':
+            jit = 1;
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-n frames] [-c cycles] [-j threads] [-l lanes] [-o results.txt] [-J] jobs.txt\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (load_jobs(argv[optind])) return EXIT_FAILURE;
+    make_units();
+    if (threads < 1) threads = 1;
+    if (threads > unit_count) threads = (unit_count ? unit_count : 1);
+
+    // deal the unit list out evenly, then let stealing even out the rest
+    worker_count = threads;
+    workers = calloc(worker_count, sizeof(struct worker));
+    for (unsigned int i = 0; i < worker_count; i ++) {
+        pthread_mutex_init(&workers[i].lock, NULL);
+        workers[i].head = (unsigned long) unit_count * i / worker_count;
+        workers[i].tail = (unsigned long) unit_count * (i + 1) / worker_count;
+    }
+    for (unsigned int i = 0; i < worker_count; i ++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i])) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    for (unsigned int i = 0; i < worker_count; i ++) {
+        pthread_join(workers[i].thread, NULL);
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+
+    FILE * out = stdout;
+    if (output && ! (out = fopen(output, "w"))) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    fprintf(out, "# rom seed screen-hash cycles error\n");
+    for (unsigned int i = 0; i < job_count; i ++) {
+        fprintf(out, "%s %u %016llx %lu %d\n", jobs[i].rom, jobs[i].seed,
+                (unsigned long long) jobs[i].hash, jobs[i].cycles, jobs[i].error);
+        free(jobs[i].rom);
+        free(jobs[i].script);
+    }
+    if (out != stdout) fclose(out);
+
+    free(jobs);
+    free(units);
+    free(workers);
+
+    return 0;
+}
@@ -1,163 +1,310 @@
 #include "interp.h"
+#include "term.h"
+#include "rewind.h"
+#include "handoff.h"
+#include "keypad.h"
 
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
-#include <curses.h>
 
-// external timers
-unsigned char timer_delay = 0;
-unsigned char timer_sound = 0;
+// one 60 Hz frame, in ns
+#define FRAME_NS 16666667L
+// most frames emulation may fall behind before the schedule starts over
+#define MAX_BEHIND 5
 
-unsigned char vblank = 0;
+// Backspace, held on the keypad past the hex keys
+#define KEY_REWIND 16
 
-// track key presses
-unsigned char keys[16] = {};
+// Emulation runs on the main thread, the terminal on a thread of its own:
+//  finished frames go to the terminal, typed keys come back, both through
+//  handoff.c, so a slow terminal can't stall emulation
 
-int do_cleanup = 0;
-void endwin_wrapper() {
-    if (do_cleanup) {
-        curs_set(1);
-        nocbreak();
-        echo();
-        endwin();
-    }
-    do_cleanup = 0;
-}
+// frame pacing, reported on exit
+struct pacing {
+    unsigned long frames;
+    unsigned long resyncs;
+    // how late each wakeup was past its deadline, in ms
+    double sum, sum_sq, worst;
+    // how long key presses waited for the frame that took them, in ms
+    unsigned long presses;
+    double input_sum;
+};
 
-unsigned char cb_check_key(unsigned char value) {
-    return keys[value];
-}
+// frontend state
+//  timers and the keypad itself live in the machine, which also waits out
+//  FX0A on its own: keys just keep coming in through chip8_set_key
+struct frontend {
+    struct machine * m;
 
-unsigned char cb_await_key() {
-    // clear all current inputs and then wait for a keypress
-    for (int i = 0; i < 16; i ++)
-        keys[i] = 0;
-
-    // await_key usually expects to take some time
-    timer_delay = 0;
-    timer_sound = 0;
-
-    // wait
-    nodelay(stdscr, FALSE);
-    int ch;
-    while (1) {
-        ch = getch();
-        if (ch >= '0' && ch <= '9') {
-            ch -= '0';
-            break;
-        }
-        else if (ch >= 'A' && ch <= 'F') {
-            ch = 0xA + ch - 'A';
-            break;
-        } else if (ch >= 'a' && ch <= 'f') {
-            ch = 0xA + ch - 'a';
-            break;
-        }
-    }
-    nodelay(stdscr, TRUE);
-    return ch;
+    // key state, from the events the terminal thread stamps and queues
+    struct keypad keypad;
+
+    struct frames frames;
+    struct key_queue typed;
+    unsigned long published;
+
+    // set by the emulation thread once it stops
+    atomic_int done;
+
+    // terminal thread: frames drawn, and frames it never got to
+    unsigned long shown;
+    unsigned long dropped;
+};
+
+static long diff_ns(const struct timespec * a, const struct timespec * b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000000000L + (a->tv_nsec - b->tv_nsec);
 }
 
-void cb_set_timer_delay(unsigned char value) {
-    timer_delay = value;
+static int64_t ns(const struct timespec * t)
+{
+    return t->tv_sec * 1000000000LL + t->tv_nsec;
 }
 
-unsigned char cb_get_timer_delay() {
-    return timer_delay;
+// hex keypad value of a character, or -1
+static int hex_key(int ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'A' && ch <= 'F')
+        return 0xA + ch - 'A';
+    if (ch >= 'a' && ch <= 'f')
+        return 0xA + ch - 'a';
+    return -1;
 }
 
-void cb_set_timer_sound(unsigned char value) {
-    timer_sound = value;
+static void add_ns(struct timespec * t, long ns)
+{
+    t->tv_nsec += ns;
+    while (t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec ++;
+    }
 }
 
-void cb_plot(unsigned char x, unsigned char y, unsigned char set)
+// hand the screen to the terminal thread
+static void publish(struct frontend * fe, int sound)
 {
-    mvaddch(y, x, (set ? '#' : ' '));
-    vblank = 1;
+    struct frame * f = frames_back(&fe->frames);
+
+    const uint64_t * screen;
+    chip8_present(fe->m, &screen);
+    memcpy(f->screen, screen, sizeof(f->screen));
+    f->number = ++ fe->published;
+    f->sound = sound;
+
+    frames_publish(&fe->frames);
 }
 
-void cb_clear()
+// the terminal thread: draws the newest frame whenever there is one, and
+//  passes key events back, stamped with when they came in
+static void * terminal(void * arg)
 {
-    clear();
+    struct frontend * fe = arg;
+
+    // the screen as the terminal has it, to find the rows that changed
+    uint64_t last[32] = {};
+    unsigned long last_number = 0;
+
+    struct pollfd pfd[2] = {
+        { .fd = fe->frames.ready, .events = POLLIN },
+        { .fd = STDIN_FILENO, .events = POLLIN },
+    };
+    while (! atomic_load(&fe->done)) {
+        poll(pfd, 2, -1);
+
+        int ch;
+        while ( (ch = term_key(0)) != -1) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const struct key_event e = { .time = ns(&now), .key = ch, .releases = term_releases() };
+            keys_push(&fe->typed, &e);
+        }
+
+        const struct frame * f = frames_latest(&fe->frames);
+        if (f) {
+            uint32_t dirty = 0;
+            for (int y = 0; y < 32; y ++) {
+                if (f->screen[y] != last[y])
+                    dirty |= (uint32_t) 1 << y;
+                last[y] = f->screen[y];
+            }
+            term_draw(f->screen, dirty);
+            if (f->sound)
+                term_beep();
+            term_flush();
+
+            fe->shown ++;
+            fe->dropped += f->number - last_number - 1;
+            last_number = f->number;
+        }
+    }
+
+    return NULL;
 }
 
 int main(int argc, char * argv[])
 {
-    if (argc != 2) {
-        printf("Usage: %s rom.ch8\n", argv[0]);
+    // instructions per frame: 15 is about what a COSMAC VIP managed
+    unsigned int ipf = 15;
+    unsigned int quirks = 0;
+    // unthrottled, drawing at most 60 times a second
+    int turbo = 0;
+    // how long a press counts as held where the terminal reports no releases
+    unsigned int hold = 3;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:wtk:")) != -1) {
+        switch (opt) {
+        case 'f':
+            ipf = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            quirks |= CHIP8_QUIRK_DISPLAY_WAIT;
+            break;
+        case 't':
+            turbo = 1;
+            break;
+        case 'k':
+            hold = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if (optind != argc - 1) {
+        printf("Usage: %s [-f instructions-per-frame] [-w] [-t] [-k hold-frames] rom.ch8\n", argv[0]);
         return -1;
     }
 
-    srand(time(NULL));
-    struct machine * m = chip8_create(
-                             cb_clear,
-                             cb_plot,
-                             cb_get_timer_delay,
-                             cb_set_timer_delay,
-                             cb_set_timer_sound,
-                             cb_check_key,
-                             cb_await_key
-                         );
+    struct frontend fe = {};
+    struct machine * m = chip8_create(NULL, NULL);
+    chip8_seed(m, time(NULL));
+    chip8_quirks(m, quirks);
+    fe.m = m;
 
 // load the ROM
     unsigned char * prog = malloc(4096);
-    FILE * f = fopen(argv[1], "rb");
+    FILE * f = fopen(argv[optind], "rb");
     unsigned int size = fread(prog, 1, 4096, f);
     fclose(f);
     chip8_load(m, prog, size);
     free(prog);
 
-    initscr();
-    atexit(endwin_wrapper);
-    do_cleanup = 1;
-
-    nodelay(stdscr, TRUE);
-    noecho();
-    cbreak();
-
-    intrflush(stdscr, FALSE);
-    keypad(stdscr, TRUE);
-    curs_set(0);
-
-    resizeterm(32, 64);
-    int error = 0;
-    while (! error) {
-        // run 100 cycles or so
-        for (int i = 0; i < 100 && !vblank; i ++) {
-            error = chip8_step(m);
-            if (error) break;
+    frames_init(&fe.frames);
+    keys_init(&fe.typed);
+    keypad_init(&fe.keypad, hold);
+    atomic_init(&fe.done, 0);
+
+    term_open();
+    pthread_t terminal_thread;
+    pthread_create(&terminal_thread, NULL, terminal, &fe);
+
+    // a couple of minutes of history for rewinding, a keyframe a second
+    struct rewind * history = rewind_create(2 * 60 * 60, 60);
+    struct chip8_state state;
+
+    // every frame has an absolute deadline, FRAME_NS after the one before,
+    //  so time spent emulating doesn't add up to drift
+    struct pacing pacing = {};
+    struct timespec deadline, now;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    add_ns(&deadline, FRAME_NS);
+
+    while (! chip8_error(m)) {
+        // the key events that came in before this frame
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const struct key_event * e;
+        while ( (e = keys_peek(&fe.typed)) && e->time <= ns(&now)) {
+            int down = ! (e->key & TERM_RELEASE);
+            int ch = e->key & ~TERM_RELEASE;
+            int key = (ch == 127 ? KEY_REWIND : hex_key(ch));
+            if (key >= 0) {
+                keypad_event(&fe.keypad, key, down, e->releases);
+                if (down) {
+                    pacing.presses ++;
+                    pacing.input_sum += (ns(&now) - e->time) / 1e6;
+                }
+            } else if (ch == '\t' && down) {
+                turbo = ! turbo;
+            }
+            keys_pop(&fe.typed);
         }
-        refresh();
-        vblank = 0;
-        // collect keyboard input
-        for (int i = 0; i < 16; i ++) {
-            if (keys[i]) keys[i] --;
+        uint32_t keys = keypad_frame(&fe.keypad);
+        for (int i = 0; i < 16; i ++)
+            chip8_set_key(m, i, (keys >> i) & 1);
+
+        int sound = 0;
+        int stepped_back = ((keys & (1 << KEY_REWIND)) && ! rewind_pop(history, &state));
+        if (stepped_back) {
+            // step back a frame instead of running one
+            chip8_restore(m, &state);
+        } else {
+            chip8_save(m, &state);
+            rewind_push(history, &state);
+
+            // a frame's worth of instructions, then the timers
+            sound = chip8_run_frame(m, ipf);
         }
 
-        // curses doesn't have keydown/keyup
-        //  so instead, we treat every keypress as a 3-frame-long keydown
-        int ch;
-        while ( (ch = getch()) != ERR) {
-            if (ch >= '0' && ch <= '9') {
-                keys[ch - '0'] = 3;
-            } else if (ch >= 'A' && ch <= 'F') {
-                keys[0xA + ch - 'A'] = 3;
-            } else if (ch >= 'a' && ch <= 'f') {
-                keys[0xA + ch - 'a'] = 3;
+        // turbo hands over a frame only once a frame's worth of time has
+        //  passed
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (! turbo || diff_ns(&now, &deadline) >= 0)
+            publish(&fe, sound);
+
+        if (turbo) {
+            // no sleeping; deadlines only pace the hand-over
+            if (diff_ns(&now, &deadline) >= 0) {
+                deadline = now;
+                add_ns(&deadline, FRAME_NS);
             }
+            continue;
         }
-        if (timer_sound) {
-            timer_sound --;
-            if (timer_sound)
-                beep();
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long late = diff_ns(&now, &deadline);
+        pacing.frames ++;
+        pacing.sum += late / 1e6;
+        pacing.sum_sq += (late / 1e6) * (late / 1e6);
+        if (late / 1e6 > pacing.worst) pacing.worst = late / 1e6;
+
+        // too far behind to catch up: start the schedule over from now
+        if (late > MAX_BEHIND * FRAME_NS) {
+            deadline = now;
+            pacing.resyncs ++;
         }
-        if (timer_delay) timer_delay --;
-        usleep(16667);
+        add_ns(&deadline, FRAME_NS);
     }
 
-    endwin_wrapper();
+    // last frame, and let the terminal thread go
+    atomic_store(&fe.done, 1);
+    publish(&fe, 0);
+    pthread_join(terminal_thread, NULL);
+
+    term_close();
     chip8_perror(m);
+    if (pacing.frames) {
+        double mean = pacing.sum / pacing.frames;
+        double var = pacing.sum_sq / pacing.frames - mean * mean;
+        fprintf(stderr, "%lu frames paced, %lu resyncs: wakeup late by %.3f ms mean, %.3f ms stddev, %.3f ms worst\n",
+            pacing.frames, pacing.resyncs, mean, sqrt(var > 0 ? var : 0), pacing.worst);
+    }
+    fprintf(stderr, "%lu frames shown, %lu dropped by the terminal\n", fe.shown, fe.dropped);
+    if (pacing.presses)
+        fprintf(stderr, "%lu key presses, taken up %.3f ms after arriving on average\n",
+            pacing.presses, pacing.input_sum / pacing.presses);
+    rewind_destroy(history);
+    frames_free(&fe.frames);
 
     return 0;
 }
@@ -0,0 +1,78 @@
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "handoff.h"
+
+#define FRESH 4
+
+void frames_init(struct frames * f)
+{
+    memset(f->slot, 0, sizeof(f->slot));
+    f->back = 0;
+    atomic_init(&f->middle, 1);
+    f->front = 2;
+    f->ready = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+void frames_free(struct frames * f)
+{
+    close(f->ready);
+}
+
+struct frame * frames_back(struct frames * f)
+{
+    return &f->slot[f->back];
+}
+
+void frames_publish(struct frames * f)
+{
+    // release: the frame is written before the reader can get the slot
+    f->back = atomic_exchange_explicit(&f->middle, f->back | FRESH, memory_order_acq_rel) & 3;
+
+    uint64_t one = 1;
+    write(f->ready, &one, sizeof(one));
+}
+
+const struct frame * frames_latest(struct frames * f)
+{
+    uint64_t count;
+    read(f->ready, &count, sizeof(count));
+
+    if (! (atomic_load_explicit(&f->middle, memory_order_relaxed) & FRESH))
+        return NULL;
+    // acquire: see the whole frame the writer put in the slot
+    f->front = atomic_exchange_explicit(&f->middle, f->front, memory_order_acq_rel) & 3;
+    return &f->slot[f->front];
+}
+
+void keys_init(struct key_queue * q)
+{
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+}
+
+int keys_push(struct key_queue * q, const struct key_event * e)
+{
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&q->head, memory_order_acquire) == KEY_QUEUE_SIZE)
+        return 1;
+
+    q->event[tail % KEY_QUEUE_SIZE] = *e;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+const struct key_event * keys_peek(struct key_queue * q)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+        return NULL;
+    return &q->event[head % KEY_QUEUE_SIZE];
+}
+
+void keys_pop(struct key_queue * q)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
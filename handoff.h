@@ -0,0 +1,65 @@
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Hand-off between curse8's emulation thread and its terminal thread
+//  frames go one way through a triple buffer, key events come back through
+//  a single-producer single-consumer ring; neither side takes a lock, so a
+//  slow terminal never holds up emulation
+
+// a finished frame
+struct frame {
+    uint64_t screen[32];
+    unsigned long number;
+    unsigned char sound;
+};
+
+// triple buffer: the writer fills its back slot and swaps it with the
+//  middle one, the reader swaps the middle one for its front slot when it
+//  holds something newer
+struct frames {
+    struct frame slot[3];
+    // index of the middle slot, and FRESH once it holds an unread frame
+    _Atomic unsigned int middle;
+    unsigned int back;      // writer's
+    unsigned int front;     // reader's
+    // eventfd, readable once a frame is published
+    int ready;
+};
+
+void frames_init(struct frames * f);
+void frames_free(struct frames * f);
+
+// the slot to write the next frame into (writer)
+struct frame * frames_back(struct frames * f);
+// hands the back slot over and wakes the reader (writer)
+void frames_publish(struct frames * f);
+// the newest frame published since the last call, or NULL if none (reader)
+const struct frame * frames_latest(struct frames * f);
+
+// a key event, as term_key returns it, stamped with when it was read
+struct key_event {
+    int64_t time;       // CLOCK_MONOTONIC, in ns
+    int key;
+    // whether the terminal reports releases
+    unsigned char releases;
+};
+
+#define KEY_QUEUE_SIZE 256
+
+struct key_queue {
+    struct key_event event[KEY_QUEUE_SIZE];
+    _Atomic unsigned int head;  // next to take
+    _Atomic unsigned int tail;  // next free
+};
+
+void keys_init(struct key_queue * q);
+// returns 0 if OK or 1 if the queue is full (producer)
+int keys_push(struct key_queue * q, const struct key_event * e);
+// the oldest event, or NULL if none; keys_pop drops it (consumer)
+const struct key_event * keys_peek(struct key_queue * q);
+void keys_pop(struct key_queue * q);
+
+#endif
@@ -0,0 +1,279 @@
+// Headless CHIP-8 driver for benchmarks and batch runs
+//  no curses, no sleeping: runs a ROM for a fixed number of frames with
+//  scripted (or no) input, printing a hash of the screen after every frame
+//  and the throughput at the end
+//
+// Built against interp.c by default, or against a recompiled run() with
+//  -DRECOMPILED, so both can be compared on the same ROM
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "script.h"
+
+#ifdef RECOMPILED
+#include "wrapper.h"
+#else
+#include "interp.h"
+#endif
+
+// run options
+unsigned long frames = 600;
+unsigned int cycles = 100;
+unsigned int quiet = 0;
+// fixed frames (chip8_run_frame) rather than stopping at each draw, and
+//  whether they follow the VIP's display wait
+unsigned int fixed = 0;
+unsigned int display_wait = 0;
+
+// frame counter and start time
+unsigned long frame = 0;
+struct timespec start;
+
+// scripted input
+struct script script = {};
+struct input input;
+
+static void report(unsigned long cycles)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fprintf(stderr, "%lu frames in %.3f s: %.0f frames/sec", frame, elapsed, frame / elapsed);
+    if (cycles)
+        fprintf(stderr, ", %lu instructions: %.0f instructions/sec", cycles, cycles / elapsed);
+    fprintf(stderr, "\n");
+}
+
+static void usage(const char * name)
+{
+#ifdef RECOMPILED
+    fprintf(stderr, "Usage: %s [-n frames] [-i script] [-s seed] [-q]\n", name);
+#else
+    fprintf(stderr, "Usage: %s [-n frames] [-c cycles] [-f] [-w] [-i script] [-s seed] [-q] [-J] rom.ch8\n", name);
+#endif
+}
+
+#ifdef RECOMPILED
+
+// CXNN generator, in the recompiled code
+extern uint32_t RNG;
+
+// timers, counted down once per frame
+uint8_t timer_delay = 0;
+uint8_t timer_sound = 0;
+
+void run();
+
+// the screen as last presented
+static const uint64_t blank[32];
+static const uint64_t * shown = blank;
+
+// runtime calls since the last frame: a program that polls the timers or
+//  keys without drawing still sees frames go by, one every POLLS_PER_FRAME
+//  calls (an interpreter frame of 100 instructions, in a three-instruction
+//  polling loop)
+#define POLLS_PER_FRAME 33
+static unsigned int polls = 0;
+
+static void end_frame()
+{
+    if (! quiet)
+        printf("%lu %016llx\n", frame, (unsigned long long) hash_screen(shown));
+    frame ++;
+    polls = 0;
+
+    if (frame >= frames) {
+        report(0);
+        exit(0);
+    }
+
+    input_poll(&input, frame);
+    if (timer_sound) timer_sound --;
+    if (timer_delay) timer_delay --;
+}
+
+static void poll_frame()
+{
+    if (++ polls >= POLLS_PER_FRAME)
+        end_frame();
+}
+
+unsigned char check_key(unsigned char value) {
+    poll_frame();
+    return input.keys[value];
+}
+
+unsigned char await_key() {
+    return input_next_key(&input);
+}
+
+uint8_t get_timer_delay() {
+    poll_frame();
+    return timer_delay;
+}
+
+void set_timer_delay(uint8_t value) {
+    poll_frame();
+    timer_delay = value;
+}
+
+void set_timer_sound(uint8_t value) {
+    poll_frame();
+    timer_sound = value;
+}
+
+// recompiled code presents once per vblank: count that as a frame
+void screen_update(const uint64_t screen[32], uint32_t dirty)
+{
+    shown = screen;
+    end_frame();
+}
+
+#else
+
+// the machine keeps its own timers, the input script supplies keys
+unsigned char cb_check_key(void * ctx, unsigned char value) {
+    return ((struct input *) ctx)->keys[value];
+}
+
+unsigned char cb_await_key(void * ctx) {
+    return input_next_key(ctx);
+}
+
+#endif
+
+int main(int argc, char * argv[])
+{
+    unsigned int seed = 1;
+#ifndef RECOMPILED
+    unsigned int jit = 0;
+#endif
+
+    int opt;
+#ifdef RECOMPILED
+    // recompiled code keeps its own pace: no cycle counts or display wait
+    const char * opts = "n:i:s:qJ";
+#else
+    const char * opts = "n:c:fwi:s:qJ";
+#endif
+    while ((opt = getopt(argc, argv, opts)) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = strtoul(optarg, NULL, 0);
+            break;
+#ifndef RECOMPILED
+        case 'c':
+            cycles = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            fixed = 1;
+            break;
+        case 'w':
+            display_wait = 1;
+            break;
+#endif
+        case 'i':
+            if (script_load(&script, optarg)) return EXIT_FAILURE;
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'J':
+            // recompiled code has no JIT to turn on
+#ifndef RECOMPILED
+            jit = 1;
+#endif
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    input_init(&input, &script);
+
+#ifdef RECOMPILED
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    RNG = (seed ? seed : 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    input_poll(&input, frame);
+    run();
+
+    // program ended by itself
+    report(0);
+    return 0;
+#else
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const struct chip8_callbacks cb = {
+        .check_key = cb_check_key,
+        .await_key = cb_await_key
+    };
+    struct machine * m = chip8_create(&cb, &input);
+    if (jit && chip8_jit(m))
+        fprintf(stderr, "No JIT on this platform, interpreting\n");
+    chip8_seed(m, seed);
+    chip8_quirks(m, display_wait ? CHIP8_QUIRK_DISPLAY_WAIT : 0);
+
+// load the ROM
+    unsigned char * prog = malloc(4096);
+    FILE * f = fopen(argv[optind], "rb");
+    if (! f) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    unsigned int size = fread(prog, 1, 4096, f);
+    fclose(f);
+    if (chip8_load(m, prog, size)) {
+        fprintf(stderr, "%s: ROM too large\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    free(prog);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // a frame is up to cycles steps, ending at a screen change, or with -f
+    //  exactly cycles steps (less any display wait) like chip8-curses
+    int error = 0;
+    while (frame < frames && ! error) {
+        input_poll(&input, frame);
+        if (fixed) {
+            chip8_run_frame(m, cycles);
+            error = (chip8_error(m) != 0);
+        } else if (chip8_run(m, cycles, CHIP8_STOP_DRAW | CHIP8_STOP_KEY) & CHIP8_STOP_ERROR)
+            error = 1;
+
+        const uint64_t * screen;
+        chip8_present(m, &screen);
+        if (! quiet)
+            printf("%lu %016llx\n", frame, (unsigned long long) hash_screen(screen));
+        frame ++;
+
+        // chip8_run_frame ran the timers already
+        if (! fixed) chip8_tick(m);
+    }
+
+    report(chip8_cycles(m));
+    if (error) chip8_perror(m);
+
+    chip8_destroy(m);
+
+    return error;
+#endif
+}
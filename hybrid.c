@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include "hybrid.h"
+#include "interp.h"
+#include "wrapper.h"
+
+// the interpreter, and its copy of the machine state between runs
+static struct machine * machine = NULL;
+static struct chip8_state state;
+
+// timers and keys stay with the runtime, as they are for native code
+static unsigned char cb_get_timer_delay(void * ctx) { return get_timer_delay(); }
+static void cb_set_timer_delay(void * ctx, unsigned char value) { set_timer_delay(value); }
+static void cb_set_timer_sound(void * ctx, unsigned char value) { set_timer_sound(value); }
+static unsigned char cb_check_key(void * ctx, unsigned char key) { return check_key(key); }
+static unsigned char cb_await_key(void * ctx) { return await_key(); }
+
+static const struct chip8_callbacks callbacks = {
+    .get_timer_delay = cb_get_timer_delay,
+    .set_timer_delay = cb_set_timer_delay,
+    .set_timer_sound = cb_set_timer_sound,
+    .check_key = cb_check_key,
+    .await_key = cb_await_key,
+};
+
+void hybrid_load(const uint8_t * rom, uint16_t size)
+{
+    machine = chip8_create(&callbacks, NULL);
+    chip8_load(machine, rom, size);
+    chip8_save(machine, &state);
+
+    memcpy(RAM, state.RAM, sizeof(RAM));
+    I = RAM;
+}
+
+uint16_t hybrid_interpret(uint16_t pc, const void * const native[4096])
+{
+    // only the code native code changed gets decoded again
+    memcpy(state.SCREEN, SCREEN, sizeof(state.SCREEN));
+    memcpy(state.RAM, RAM, sizeof(state.RAM));
+    memcpy(state.V, V, sizeof(state.V));
+    state.I = I - RAM;
+    state.PC = pc;
+    memcpy(state.STACK, stack, sizeof(state.STACK));
+    state.SP = sp;
+    state.RNG = RNG;
+    chip8_restore(machine, &state);
+    // which marks every row, but native code has kept its own count
+    const uint64_t * screen;
+    chip8_present(machine, &screen);
+
+    do {
+        // sprites and clears are shown as native code shows them
+        if (chip8_run(machine, 1, CHIP8_STOP_DRAW) & CHIP8_STOP_DRAW) {
+            DIRTY |= chip8_present(machine, &screen);
+            memcpy(SCREEN, screen, sizeof(SCREEN));
+            screen_update(SCREEN, DIRTY);
+            DIRTY = 0;
+        }
+
+        if (chip8_error(machine)) {
+            // native code ends on an infinite loop without a word too
+            if (chip8_error(machine) != INFINITE_LOOP)
+                chip8_perror(machine);
+            return 0;
+        }
+        // BNNN can leave PC past RAM, for the next step to stop on
+    } while (chip8_pc(machine) >= 4096 || ! native[chip8_pc(machine)]);
+
+    chip8_save(machine, &state);
+    memcpy(SCREEN, state.SCREEN, sizeof(SCREEN));
+    memcpy(RAM, state.RAM, sizeof(RAM));
+    memcpy(V, state.V, sizeof(V));
+    I = RAM + state.I;
+    memcpy(stack, state.STACK, sizeof(stack));
+    sp = state.SP;
+    RNG = state.RNG;
+
+    return state.PC;
+}
@@ -0,0 +1,32 @@
+#ifndef HYBRID_H_
+#define HYBRID_H_
+
+#include <stdint.h>
+
+// Interpreter fallback for hybrid recompiled programs (recompile.pl -i)
+//  code the analysis could not prove runs on interp.c instead, on the same
+//  machine state, which the generated program defines; the interpreter hands
+//  back at the first address native code can be entered at
+
+#define HYBRID_STACK_DEPTH 16
+
+extern uint64_t SCREEN[32];
+// rows changed but not shown yet
+extern uint32_t DIRTY;
+extern uint8_t RAM[4096];
+extern uint8_t V[16];
+extern uint8_t * I;
+// return addresses, as the interpreter keeps them
+extern uint16_t stack[HYBRID_STACK_DEPTH];
+extern uint8_t sp;
+extern uint32_t RNG;
+
+// sets up the interpreter, and RAM with the font and the program
+void hybrid_load(const uint8_t * rom, uint16_t size);
+
+// runs the interpreter from pc until it reaches an address native has a
+//  label for, and returns that address
+//  returns 0 once the program has ended (an error, or an infinite loop)
+uint16_t hybrid_interpret(uint16_t pc, const void * const native[4096]);
+
+#endif
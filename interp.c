@@ -1,26 +1,78 @@
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "interp.h"
+#include "jit.h"
+
 #define debug(...) ;
 
-// error codes
-enum error {
-    NONE = 0,
-    PC_UNDERFLOW,
-    PC_OVERFLOW,
-    STACK_OVERFLOW,
-    STACK_UNDERFLOW,
-    INFINITE_LOOP,
-    ILLEGAL_INSTRUCTION,
-    ILLEGAL_DIGIT,
-    INDEX_OVERFLOW,
-    BAD_KEY
+// instruction handlers, indexes into the dispatch table in execute()
+enum handler {
+    OP_DECODE = 0,
+    OP_CLEAR,
+    OP_RETURN,
+    OP_JUMP,
+    OP_JUMP_SELF,
+    OP_CALL,
+    OP_SKIP_EQ_LIT,
+    OP_SKIP_NEQ_LIT,
+    OP_SKIP_EQ_REG,
+    OP_SET_LIT,
+    OP_ADD_LIT,
+    OP_SET_REG,
+    OP_OR,
+    OP_AND,
+    OP_XOR,
+    OP_ADD,
+    OP_SUB,
+    OP_SHR,
+    OP_SUBN,
+    OP_SHL,
+    OP_SKIP_NEQ_REG,
+    OP_SET_I,
+    OP_JUMP_V0,
+    OP_RAND,
+    OP_PLOT,
+    OP_SKIP_KEY,
+    OP_SKIP_NKEY,
+    OP_GET_DELAY,
+    OP_AWAIT_KEY,
+    OP_SET_DELAY,
+    OP_SET_SOUND,
+    OP_ADD_I,
+    OP_DIGIT,
+    OP_BCD,
+    OP_STORE,
+    OP_LOAD,
+    OP_ILLEGAL
+};
+
+// a predecoded instruction
+//  operands are pulled out of the opcode once, when the instruction is first executed
+struct decoded {
+    unsigned char handler;
+
+    unsigned char b;
+    unsigned char c;
+    unsigned char l;
+    unsigned short addr;
+
+    // pad to 8 bytes so indexing the cache is a shift
+    unsigned short pad;
 };
 
+// BNNN can send the PC as far as 0xFFF + 0xFF, so the decode cache
+//  needs a (never decoded) entry for every address up to there
+#define CODE_SIZE (4096 + 256)
+
 struct machine {
     // we track the screen ourselves for collision etc
-    unsigned char SCREEN[32][64];
+    //  one bit per pixel, the leftmost pixel of each row in the top bit
+    uint64_t SCREEN[32];
+    // rows changed since the last chip8_present, one bit per row
+    uint32_t DIRTY;
 
     unsigned char RAM[4096];
 
@@ -32,56 +84,76 @@ struct machine {
     unsigned short STACK[16];
     unsigned char SP;
 
-    // callbacks
-    void (*cb_clear)(void);
-    void (*cb_plot)(unsigned char x, unsigned char y, unsigned char set);
-    unsigned char (*cb_get_timer_delay)(void);
-    void (*cb_set_timer_delay)(unsigned char value);
-    void (*cb_set_timer_sound)(unsigned char value);
-    unsigned char (*cb_check_key)(unsigned char key);
-    unsigned char (*cb_await_key)(void);
+    // decode cache, indexed by PC
+    struct decoded CODE[CODE_SIZE];
+
+    // built-in timers and keypad, used in place of NULL callbacks
+    unsigned char TIMER_DELAY;
+    unsigned char TIMER_SOUND;
+    unsigned char KEYS[16];
+
+    // FX0A with no await_key callback: 0x10 | x while waiting for a key
+    //  into V[x], and the keys pressed since the wait began
+    unsigned char AWAIT;
+    uint16_t AWAIT_DOWN;
+
+    // xorshift32 state for CXNN, never 0
+    uint32_t RNG;
+
+    // callbacks, and the context they all get
+    struct chip8_callbacks cb;
+    void * ctx;
+
+    // CHIP8_QUIRK_* flags
+    unsigned int quirks;
+
+    // native code for chip8_run, if turned on
+    struct jit * jit;
+
+    // steps run so far
+    unsigned long cycles;
 
     // crash / error handler
     enum error err;
 };
 
+// hex digit sprites for FX29, at the bottom of RAM
+const unsigned char chip8_font[0x10 * 5] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
 // Create a new CHIP-8 machine
-struct machine * chip8_create(
-    void (*cb_clear)(void),
-    void (*cb_plot)(unsigned char x, unsigned char y, unsigned char set),
-    unsigned char (*cb_get_timer_delay)(void),
-    void (*cb_set_timer_delay)(unsigned char value),
-    void (*cb_set_timer_sound)(unsigned char value),
-    unsigned char (*cb_check_key)(unsigned char key),
-    unsigned char (*cb_await_key)(void)
-)
+struct machine * chip8_create(const struct chip8_callbacks * cb, void * ctx)
 {
-    static const unsigned char FONT[0x10 * 5] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
-
     struct machine * sys = malloc(sizeof(struct machine));
 
     // clear screen
-    memset(sys->SCREEN, 0, 32 * 64);
+    memset(sys->SCREEN, 0, sizeof(sys->SCREEN));
+    sys->DIRTY = 0xFFFFFFFF;
+
+    // RAM, registers and stack start out zero, as in the lockstep engine,
+    //  so nothing carries over from what the heap held before
+    memset(sys->RAM, 0, sizeof(sys->RAM));
+    memset(sys->V, 0, sizeof(sys->V));
+    memset(sys->STACK, 0, sizeof(sys->STACK));
 
     // copy font data
-    memcpy(sys->RAM, FONT, sizeof(FONT));
+    memcpy(sys->RAM, chip8_font, sizeof(chip8_font));
     // set up ptr to font
     sys->I = 0;
 
@@ -91,16 +163,30 @@ struct machine * chip8_create(
     // stack pointer at bottom
     sys->SP = 0;
 
+    // nothing decoded yet
+    memset(sys->CODE, 0, sizeof(sys->CODE));
+
+    // timers stopped, no keys down
+    sys->TIMER_DELAY = 0;
+    sys->TIMER_SOUND = 0;
+    memset(sys->KEYS, 0, sizeof(sys->KEYS));
+    sys->AWAIT = 0;
+    sys->AWAIT_DOWN = 0;
+
+    sys->RNG = 1;
+
     // copy the callback ptrs
-    sys->cb_clear = cb_clear;
-    sys->cb_plot = cb_plot;
-    sys->cb_get_timer_delay = cb_get_timer_delay;
-    sys->cb_set_timer_delay = cb_set_timer_delay;
-    sys->cb_set_timer_sound = cb_set_timer_sound;
-    sys->cb_check_key = cb_check_key;
-    sys->cb_await_key = cb_await_key;
+    if (cb)
+        sys->cb = *cb;
+    else
+        memset(&sys->cb, 0, sizeof(sys->cb));
+    sys->ctx = ctx;
+
+    sys->quirks = 0;
+    sys->jit = NULL;
 
     // no errors (so far)
+    sys->cycles = 0;
     sys->err = NONE;
 
     return sys;
@@ -111,6 +197,9 @@ int chip8_load(struct machine * sys, const unsigned char * rom_data, const unsig
 {
     if (rom_size <= 4096 - 0x200) {
         memcpy(& sys->RAM[0x200], rom_data, rom_size);
+        // throw away anything decoded from the old contents
+        memset(sys->CODE, 0, sizeof(sys->CODE));
+        if (sys->jit) jit_flush(sys->jit);
         return 0;
     }
 
@@ -120,6 +209,7 @@ int chip8_load(struct machine * sys, const unsigned char * rom_data, const unsig
 // Frees a machine
 void chip8_destroy(struct machine * sys)
 {
+    if (sys->jit) jit_destroy(sys->jit);
     free(sys);
 }
 
@@ -148,354 +238,746 @@ void chip8_perror(const struct machine * sys)
     }
 }
 
-// Runs one step of a machine
-//  returns 0 if OK or 1 if an error occurred
-int chip8_step(struct machine * sys)
+int chip8_error(const struct machine * sys)
 {
+    return sys->err;
+}
 
-// helpers to parse an instruction
-#define opA ((op & 0xF000) >> 12)
-#define opB ((op & 0x0F00) >> 8)
-#define opC ((op & 0x00F0) >> 4)
-#define opD (op & 0x000F)
-
-#define opL (op & 0x00FF)
-
-#define opADDR (op & 0x0FFF)
-
-    //debug("0x%04x : ", (sys->PC - sys->RAM));
-    //unsigned char * initialPC = sys->PC;
-    if (sys->PC < 0x200) {
-        sys->err = PC_UNDERFLOW;
-        return sys->err;
-    } else if (sys->PC >= 4095) {
-        // PC overflow!
-        sys->err = PC_OVERFLOW;
-        return sys->err;
-    }
+// Drops cached decodes that overlap a write of size bytes at addr
+//  an instruction starting one byte before addr also contains addr
+static void invalidate(struct machine * sys, unsigned short addr, unsigned short size)
+{
+    unsigned short start = (addr > 0 ? addr - 1 : 0);
+    for (unsigned short a = start; a < addr + size; a ++)
+        sys->CODE[a].handler = OP_DECODE;
+    if (sys->jit) jit_invalidate(sys->jit, addr, size);
+}
 
-    unsigned short op = (sys->RAM[sys->PC] << 8) | sys->RAM[sys->PC + 1];
-    sys->PC += 2;
+// Picks the handler and operands for the opcode at addr
+static void decode(struct decoded * d, unsigned short addr, unsigned short op)
+{
+    d->b = (op & 0x0F00) >> 8;
+    d->c = (op & 0x00F0) >> 4;
+    d->l = (op & 0x00FF);
+    d->addr = (op & 0x0FFF);
 
-    //debug("[0x%04x] : ", op);
+    unsigned char opD = op & 0x000F;
 
-    switch(opA) {
+    switch ((op & 0xF000) >> 12) {
     case 0:
-        debug("CALL ");
-        switch(opADDR) {
-        case 0x0E0:
-            memset(sys->SCREEN, 0, 32 * 64);
-            if (sys->cb_clear) sys->cb_clear();
-            debug("CLEAR SCREEN");
-            break;
-        case 0x0EE:
-            if (sys->SP < 1) {
-                // Can't pop something off stack that isn't there
-                sys->err = STACK_UNDERFLOW;
-                return sys->err;
-            }
-            sys->SP --;
-            sys->PC = sys->STACK[sys->SP];
-            debug("RETURN TO %04x", *sys->SP - sys->RAM);
-            break;
-        default:
-            sys->err = ILLEGAL_INSTRUCTION;
-            sys->PC -= 2;
-            return sys->err;
-        }
-        debug("\n");
+        if (d->addr == 0x0E0) d->handler = OP_CLEAR;
+        else if (d->addr == 0x0EE) d->handler = OP_RETURN;
+        else d->handler = OP_ILLEGAL;
         break;
     case 1:
-        debug("JUMP TO %04x\n", opADDR);
-        if (opADDR == sys->PC - 2) {
-            // Detected simple infinite loop
-            sys->err = INFINITE_LOOP;
-            sys->PC -= 2;
-            return sys->err;
-        }
-        sys->PC = opADDR;
+        d->handler = (d->addr == addr ? OP_JUMP_SELF : OP_JUMP);
         break;
     case 2:
-        debug("CALL SUB AT %04x\n", opADDR);
-        // sub
-        if (sys->SP > 15) {
-            // Can't push more than 16 items on the stack
-            sys->err = STACK_OVERFLOW;
-            return sys->err;
-        }
-        sys->STACK[sys->SP] = sys->PC;
-        sys->SP ++;
-
-        sys->PC = opADDR;
+        d->handler = OP_CALL;
         break;
     case 3:
-        debug("CHECK V[%d] == %d\n", opB, opL);
-        // literal EQ
-        if (sys->V[opB] == opL)
-            sys->PC += 2;
+        d->handler = OP_SKIP_EQ_LIT;
         break;
     case 4:
-        debug("CHECK V[%d] != %d\n", opB, opL);
-        // literal NEQ
-        if (sys->V[opB] != opL)
-            sys->PC += 2;
+        d->handler = OP_SKIP_NEQ_LIT;
         break;
     case 5:
-        debug("COMPARE: ");
-        switch(opD) {
-        case 0:
-            debug("CHECK V[%d] == V[%d]", opB, opC);
-            if (sys->V[opB] == sys->V[opC])
-                sys->PC += 2;
-
-            break;
-        default:
-            sys->err = ILLEGAL_INSTRUCTION;
-            sys->PC -= 2;
-            return sys->err;
-        }
-        debug("\n");
+        d->handler = (opD == 0 ? OP_SKIP_EQ_REG : OP_ILLEGAL);
         break;
     case 6:
-        debug("SET V[%d] == %d\n", opB, opL);
-        sys->V[opB] = opL;
+        d->handler = OP_SET_LIT;
         break;
     case 7:
-        debug("ADD V[%d] += %d\n", opB, opL);
-        sys->V[opB] += opL;
+        d->handler = OP_ADD_LIT;
         break;
     case 8:
-        debug("ALU OP ");
-        switch(opD) {
-        case 0:
-            debug("SET V[%d] = V[%d]", opB, opC);
-            sys->V[opB] = sys->V[opC];
-            break;
-        case 1:
-            debug("SET V[%d] |= V[%d]", opB, opC);
-            sys->V[opB] |= sys->V[opC];
-            sys->V[0xF] = 0;
-            break;
-        case 2:
-            debug("SET V[%d] &= V[%d]", opB, opC);
-            sys->V[opB] &= sys->V[opC];
-            sys->V[0xF] = 0;
-            break;
-        case 3:
-            debug("SET V[%d] ^= V[%d]", opB, opC);
-            sys->V[opB] ^= sys->V[opC];
-            sys->V[0xF] = 0;
-            break;
-        case 4: {
-            debug("SET V[%d] += V[%d]", opB, opC);
-            unsigned short result = sys->V[opB] + sys->V[opC];
-            sys->V[opB] = result & 0xFF;
-            sys->V[0xF] = (result > 255 ? 1 : 0);
-            break;
-        }
-        case 5: {
-            debug("SET V[%d] -= V[%d]", opB, opC);
-            unsigned short result = sys->V[opB] - sys->V[opC];
-            sys->V[opB] = result & 0xFF;
-            sys->V[0xF] = (result > 255 ? 0 : 1);
-            break;
-        }
-        case 6: {
-            debug("SET V[%d] = V[%d] >> 1", opB, opC);
-            unsigned char bit = sys->V[opC] & 1;
-            sys->V[opB] = sys->V[opC] >> 1;
-            sys->V[0xF] = bit;
-            break;
-        }
-        case 7: {
-            debug("SET V[%d] = V[%d] - V[%d]", opB, opC, opB);
-            unsigned short result = sys->V[opC] - sys->V[opB];
-            sys->V[opB] = result & 0xFF;
-            sys->V[0xF] = (result > 255 ? 0 : 1);
-            break;
-        }
-        case 0xE: {
-            debug("SET V[%d] = V[%d] << 1", opB, opC);
-            unsigned char bit = (sys->V[opC] & 0x80) >> 7;
-            sys->V[opB] = sys->V[opC] << 1;
-            sys->V[0xF] = bit;
-            break;
-        }
-        default:
-            sys->err = ILLEGAL_INSTRUCTION;
-            sys->PC -= 2;
-            return sys->err;
+        switch (opD) {
+        case 0: d->handler = OP_SET_REG; break;
+        case 1: d->handler = OP_OR; break;
+        case 2: d->handler = OP_AND; break;
+        case 3: d->handler = OP_XOR; break;
+        case 4: d->handler = OP_ADD; break;
+        case 5: d->handler = OP_SUB; break;
+        case 6: d->handler = OP_SHR; break;
+        case 7: d->handler = OP_SUBN; break;
+        case 0xE: d->handler = OP_SHL; break;
+        default: d->handler = OP_ILLEGAL; break;
         }
         break;
     case 9:
-        debug("REG COMPARE ");
-        switch(opD) {
-        case 0:
-            debug("CHECK V[%d] != V[%d]\n", opB, opC);
-            if (sys->V[opB] != sys->V[opC])
-                sys->PC += 2;
-
-            break;
-        default:
-            sys->err = ILLEGAL_INSTRUCTION;
-            sys->PC -= 2;
-            return sys->err;
-        }
+        d->handler = (opD == 0 ? OP_SKIP_NEQ_REG : OP_ILLEGAL);
         break;
     case 0xA:
-        debug("SET I = %04x\n", opADDR);
-        sys->I = opADDR;
+        d->handler = OP_SET_I;
         break;
     case 0xB:
-        debug("SET PC = %04x + V0\n", opADDR);
-        sys->PC = opADDR + sys->V[0];
+        d->handler = OP_JUMP_V0;
         break;
     case 0xC:
-        debug("GET RAND\n");
-        sys->V[opB] = rand() & opL;
+        d->handler = OP_RAND;
         break;
     case 0xD:
-        debug("PLOT SPRITE AT X=V[%d] Y=V[%d] H=%d\n", opB, opC, opD);
-// sprite
-        sys->V[0xF] = 0;
+        d->handler = OP_PLOT;
+        break;
+    case 0xE:
+        if (d->l == 0x9E) d->handler = OP_SKIP_KEY;
+        else if (d->l == 0xA1) d->handler = OP_SKIP_NKEY;
+        else d->handler = OP_ILLEGAL;
+        break;
+    case 0xF:
+        switch (d->l) {
+        case 0x07: d->handler = OP_GET_DELAY; break;
+        case 0x0A: d->handler = OP_AWAIT_KEY; break;
+        case 0x15: d->handler = OP_SET_DELAY; break;
+        case 0x18: d->handler = OP_SET_SOUND; break;
+        case 0x1E: d->handler = OP_ADD_I; break;
+        case 0x29: d->handler = OP_DIGIT; break;
+        case 0x33: d->handler = OP_BCD; break;
+        case 0x55: d->handler = OP_STORE; break;
+        case 0x65: d->handler = OP_LOAD; break;
+        default: d->handler = OP_ILLEGAL; break;
+        }
+        break;
+    }
+}
 
-        unsigned char screenY = sys->V[opC] % 32;
+// Runs up to max_cycles steps of a machine, or until an event in stop_mask
+//  each handler finishes by jumping straight to the handler of the next
+//  instruction, so there is no central switch to go back through
+//  returns the CHIP8_STOP_* events that ended the run, or 0 if out of cycles
+static int execute(struct machine * sys, unsigned int max_cycles, unsigned int stop_mask)
+{
+    static const void * const dispatch[] = {
+        [OP_DECODE] = &&op_decode,
+        [OP_CLEAR] = &&op_clear,
+        [OP_RETURN] = &&op_return,
+        [OP_JUMP] = &&op_jump,
+        [OP_JUMP_SELF] = &&op_jump_self,
+        [OP_CALL] = &&op_call,
+        [OP_SKIP_EQ_LIT] = &&op_skip_eq_lit,
+        [OP_SKIP_NEQ_LIT] = &&op_skip_neq_lit,
+        [OP_SKIP_EQ_REG] = &&op_skip_eq_reg,
+        [OP_SET_LIT] = &&op_set_lit,
+        [OP_ADD_LIT] = &&op_add_lit,
+        [OP_SET_REG] = &&op_set_reg,
+        [OP_OR] = &&op_or,
+        [OP_AND] = &&op_and,
+        [OP_XOR] = &&op_xor,
+        [OP_ADD] = &&op_add,
+        [OP_SUB] = &&op_sub,
+        [OP_SHR] = &&op_shr,
+        [OP_SUBN] = &&op_subn,
+        [OP_SHL] = &&op_shl,
+        [OP_SKIP_NEQ_REG] = &&op_skip_neq_reg,
+        [OP_SET_I] = &&op_set_i,
+        [OP_JUMP_V0] = &&op_jump_v0,
+        [OP_RAND] = &&op_rand,
+        [OP_PLOT] = &&op_plot,
+        [OP_SKIP_KEY] = &&op_skip_key,
+        [OP_SKIP_NKEY] = &&op_skip_nkey,
+        [OP_GET_DELAY] = &&op_get_delay,
+        [OP_AWAIT_KEY] = &&op_await_key,
+        [OP_SET_DELAY] = &&op_set_delay,
+        [OP_SET_SOUND] = &&op_set_sound,
+        [OP_ADD_I] = &&op_add_i,
+        [OP_DIGIT] = &&op_digit,
+        [OP_BCD] = &&op_bcd,
+        [OP_STORE] = &&op_store,
+        [OP_LOAD] = &&op_load,
+        [OP_ILLEGAL] = &&op_illegal
+    };
 
-        for (int y = 0; y < opD; y ++) {
-            if (sys->I + y > 4095) {
-                sys->err = INDEX_OVERFLOW;
-                return sys->err;
-            }
-            unsigned char v = sys->RAM[sys->I + y];
-
-            unsigned char screenX = sys->V[opB] % 64;
-            for (int x = 0; x < 8; x ++) {
-                if (v & (0x80 >> x)) {
-                    unsigned char p = ! sys->SCREEN[screenY][screenX];
-                    if (sys->cb_plot) sys->cb_plot(screenX, screenY, p);
-                    sys->SCREEN[screenY][screenX] = p;
-                    if ( ! p) sys->V[0xF] = 1;
-                }
-                screenX ++;
-                if (screenX > 63) break;
+// helpers to read the current instruction
+#define opB (d->b)
+#define opC (d->c)
+#define opD (d->l & 0x0F)
+
+#define opL (d->l)
+
+#define opADDR (d->addr)
+
+// go to the next instruction, or stop if we are out of cycles
+#define NEXT do { \
+        if (! -- cycles) goto done; \
+        d = &sys->CODE[PC]; \
+        goto *dispatch[d->handler]; \
+    } while (0)
+
+// finish the current instruction and stop, if the caller asked for it
+#define STOP(e) do { \
+        if (stop_mask & (e)) { \
+            events = (e); \
+            cycles --; \
+            goto done; \
+        } \
+    } while (0)
+
+// stop with an error
+#define FAIL(e) do { \
+        sys->err = e; \
+        events = CHIP8_STOP_ERROR; \
+        goto done; \
+    } while (0)
+
+    if (sys->AWAIT) return CHIP8_STOP_WAIT;
+    if (max_cycles == 0) return 0;
+
+    unsigned int cycles = max_cycles;
+    int events = 0;
+
+    // registers are kept in locals while running, so the compiler can
+    //  hold them in machine registers across instructions and callbacks
+    unsigned int PC = sys->PC;
+    unsigned short I = sys->I;
+    unsigned char V[16];
+    memcpy(V, sys->V, sizeof(V));
+
+    const struct decoded * d = &sys->CODE[PC];
+    goto *dispatch[d->handler];
+
+op_decode:
+    //debug("0x%04x : ", PC);
+    if (PC < 0x200) {
+        FAIL(PC_UNDERFLOW);
+    } else if (PC >= 4095) {
+        // PC overflow!
+        FAIL(PC_OVERFLOW);
+    }
+    decode(&sys->CODE[PC], PC, (sys->RAM[PC] << 8) | sys->RAM[PC + 1]);
+    goto *dispatch[d->handler];
+
+op_clear:
+    debug("CLEAR SCREEN\n");
+    PC += 2;
+    memset(sys->SCREEN, 0, sizeof(sys->SCREEN));
+    sys->DIRTY = 0xFFFFFFFF;
+    if (sys->cb.clear) sys->cb.clear(sys->ctx);
+    STOP(CHIP8_STOP_DRAW);
+    NEXT;
+
+op_return:
+    PC += 2;
+    if (sys->SP < 1) {
+        // Can't pop something off stack that isn't there
+        FAIL(STACK_UNDERFLOW);
+    }
+    sys->SP --;
+    PC = sys->STACK[sys->SP];
+    debug("RETURN TO %04x\n", PC);
+    NEXT;
+
+op_jump:
+    debug("JUMP TO %04x\n", opADDR);
+    PC = opADDR;
+    NEXT;
+
+op_jump_self:
+    // Detected simple infinite loop
+    FAIL(INFINITE_LOOP);
+
+op_call:
+    debug("CALL SUB AT %04x\n", opADDR);
+    PC += 2;
+    // sub
+    if (sys->SP > 15) {
+        // Can't push more than 16 items on the stack
+        FAIL(STACK_OVERFLOW);
+    }
+    sys->STACK[sys->SP] = PC;
+    sys->SP ++;
+
+    PC = opADDR;
+    NEXT;
+
+op_skip_eq_lit:
+    debug("CHECK V[%d] == %d\n", opB, opL);
+    // literal EQ
+    PC += (V[opB] == opL ? 4 : 2);
+    NEXT;
+
+op_skip_neq_lit:
+    debug("CHECK V[%d] != %d\n", opB, opL);
+    // literal NEQ
+    PC += (V[opB] != opL ? 4 : 2);
+    NEXT;
+
+op_skip_eq_reg:
+    debug("CHECK V[%d] == V[%d]\n", opB, opC);
+    PC += (V[opB] == V[opC] ? 4 : 2);
+    NEXT;
+
+op_set_lit:
+    debug("SET V[%d] == %d\n", opB, opL);
+    PC += 2;
+    V[opB] = opL;
+    NEXT;
+
+op_add_lit:
+    debug("ADD V[%d] += %d\n", opB, opL);
+    PC += 2;
+    V[opB] += opL;
+    NEXT;
+
+op_set_reg:
+    debug("SET V[%d] = V[%d]\n", opB, opC);
+    PC += 2;
+    V[opB] = V[opC];
+    NEXT;
+
+op_or:
+    debug("SET V[%d] |= V[%d]\n", opB, opC);
+    PC += 2;
+    V[opB] |= V[opC];
+    V[0xF] = 0;
+    NEXT;
+
+op_and:
+    debug("SET V[%d] &= V[%d]\n", opB, opC);
+    PC += 2;
+    V[opB] &= V[opC];
+    V[0xF] = 0;
+    NEXT;
+
+op_xor:
+    debug("SET V[%d] ^= V[%d]\n", opB, opC);
+    PC += 2;
+    V[opB] ^= V[opC];
+    V[0xF] = 0;
+    NEXT;
+
+op_add: {
+    debug("SET V[%d] += V[%d]\n", opB, opC);
+    PC += 2;
+    unsigned short result = V[opB] + V[opC];
+    V[opB] = result & 0xFF;
+    V[0xF] = (result > 255 ? 1 : 0);
+    NEXT;
+}
+
+op_sub: {
+    debug("SET V[%d] -= V[%d]\n", opB, opC);
+    PC += 2;
+    unsigned short result = V[opB] - V[opC];
+    V[opB] = result & 0xFF;
+    V[0xF] = (result > 255 ? 0 : 1);
+    NEXT;
+}
+
+op_shr: {
+    debug("SET V[%d] = V[%d] >> 1\n", opB, opC);
+    PC += 2;
+    unsigned char bit = V[opC] & 1;
+    V[opB] = V[opC] >> 1;
+    V[0xF] = bit;
+    NEXT;
+}
+
+op_subn: {
+    debug("SET V[%d] = V[%d] - V[%d]\n", opB, opC, opB);
+    PC += 2;
+    unsigned short result = V[opC] - V[opB];
+    V[opB] = result & 0xFF;
+    V[0xF] = (result > 255 ? 0 : 1);
+    NEXT;
+}
+
+op_shl: {
+    debug("SET V[%d] = V[%d] << 1\n", opB, opC);
+    PC += 2;
+    unsigned char bit = (V[opC] & 0x80) >> 7;
+    V[opB] = V[opC] << 1;
+    V[0xF] = bit;
+    NEXT;
+}
+
+op_skip_neq_reg:
+    debug("CHECK V[%d] != V[%d]\n", opB, opC);
+    PC += (V[opB] != V[opC] ? 4 : 2);
+    NEXT;
+
+op_set_i:
+    debug("SET I = %04x\n", opADDR);
+    PC += 2;
+    I = opADDR;
+    NEXT;
+
+op_jump_v0:
+    debug("SET PC = %04x + V0\n", opADDR);
+    PC = opADDR + V[0];
+    NEXT;
+
+op_rand: {
+    debug("GET RAND\n");
+    PC += 2;
+    // xorshift32, the top byte masked
+    uint32_t x = sys->RNG;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sys->RNG = x;
+    V[opB] = (x >> 24) & opL;
+    NEXT;
+}
+
+op_plot: {
+    debug("PLOT SPRITE AT X=V[%d] Y=V[%d] H=%d\n", opB, opC, opD);
+    PC += 2;
+// sprite
+    unsigned char screenX = V[opB] % 64;
+    unsigned char screenY = V[opC] % 32;
+
+    // clip at the bottom edge
+    unsigned char height = opD;
+    if (screenY + height > 32) height = 32 - screenY;
+
+    unsigned char collision = 0;
+    for (int y = 0; y < height; y ++) {
+        if (I + y > 4095) {
+            V[0xF] = collision;
+            FAIL(INDEX_OVERFLOW);
+        }
+        // line the sprite byte up with the row: anything past the right
+        //  edge is shifted out
+        uint64_t sprite = ((uint64_t) sys->RAM[I + y] << 56) >> screenX;
+        uint64_t * row = &sys->SCREEN[screenY + y];
+
+        if (*row & sprite) collision = 1;
+        *row ^= sprite;
+        if (sprite) sys->DIRTY |= (uint32_t) 1 << (screenY + y);
+
+        if (sys->cb.plot) {
+            // report each toggled pixel
+            for (; sprite; sprite &= sprite - 1) {
+                unsigned char bit = __builtin_ctzll(sprite);
+                sys->cb.plot(sys->ctx, 63 - bit, screenY + y, (*row >> bit) & 1);
             }
-            screenY ++;
-            if (screenY > 31) break;
         }
-        break;
-    case 0xE:
-        debug("TRAP ");
-        switch(opL) {
-        case 0x9E:
+    }
+    V[0xF] = collision;
+    STOP(CHIP8_STOP_DRAW | CHIP8_STOP_SPRITE);
+    NEXT;
+}
+
+op_skip_key:
 // check key press
-            debug("CHECK KEYDOWN %d\n", opB);
-            if (sys->V[opB] > 15) {
-                sys->err = BAD_KEY;
-                return sys->err;
-            }
+    debug("CHECK KEYDOWN %d\n", opB);
+    PC += 2;
+    if (V[opB] > 15) {
+        FAIL(BAD_KEY);
+    }
+
+    if (sys->cb.check_key ? sys->cb.check_key(sys->ctx, V[opB]) : sys->KEYS[V[opB]])
+        PC += 2;
+    NEXT;
 
-            if (sys->cb_check_key && sys->cb_check_key(sys->V[opB]))
-                sys->PC += 2;
-            break;
-        case 0xA1:
+op_skip_nkey:
 // check key release
-            debug("CHECK KEY UP %d\n", opB);
-            if (sys->V[opB] > 15) {
-                sys->err = BAD_KEY;
-                return sys->err;
-            }
-            if (sys->cb_check_key && ! sys->cb_check_key(sys->V[opB]))
-                sys->PC += 2;
-            break;
-        default:
-            sys->err = ILLEGAL_INSTRUCTION;
-            sys->PC -= 2;
-            return sys->err;
-        }
-        break;
-        debug("\n");
-    case 0xF:
-        debug("TRAP2 ");
-        switch (opL) {
-        case 0x07:
+    debug("CHECK KEY UP %d\n", opB);
+    PC += 2;
+    if (V[opB] > 15) {
+        FAIL(BAD_KEY);
+    }
+    if (! (sys->cb.check_key ? sys->cb.check_key(sys->ctx, V[opB]) : sys->KEYS[V[opB]]))
+        PC += 2;
+    NEXT;
+
+op_get_delay:
 // get delay timer
-            debug("GET DELAY TIMER INTO V[%d]", opB);
-            if (sys->cb_get_timer_delay) sys->V[opB] = sys->cb_get_timer_delay();
-            break;
-        case 0x0A:
+    debug("GET DELAY TIMER INTO V[%d]\n", opB);
+    PC += 2;
+    V[opB] = (sys->cb.get_timer_delay ? sys->cb.get_timer_delay(sys->ctx) : sys->TIMER_DELAY);
+    NEXT;
+
+op_await_key:
 // wait keypress
-            debug("AWAIT KEY INTO V[%d]", opB);
-            if (sys->cb_await_key) sys->V[opB] = sys->cb_await_key();
-            break;
-        case 0x15:
+    debug("AWAIT KEY INTO V[%d]\n", opB);
+    if (! sys->cb.await_key) {
+        // the machine waits on its own keypad: nothing runs until
+        //  chip8_set_key finishes the instruction
+        sys->AWAIT = 0x10 | opB;
+        sys->AWAIT_DOWN = 0;
+        events = CHIP8_STOP_WAIT;
+        goto done;
+    }
+    PC += 2;
+    V[opB] = sys->cb.await_key(sys->ctx);
+    // await_key usually expects to take some time
+    if (! sys->cb.set_timer_delay) sys->TIMER_DELAY = 0;
+    if (! sys->cb.set_timer_sound) sys->TIMER_SOUND = 0;
+    STOP(CHIP8_STOP_KEY);
+    NEXT;
+
+op_set_delay:
 // set delay timer
-            debug("SET DELAY TIMER FROM V[%d]", opB);
-            if (sys->cb_set_timer_delay) sys->cb_set_timer_delay( sys->V[opB] );
-            break;
-        case 0x18:
+    debug("SET DELAY TIMER FROM V[%d]\n", opB);
+    PC += 2;
+    if (sys->cb.set_timer_delay) sys->cb.set_timer_delay(sys->ctx, V[opB]);
+    else sys->TIMER_DELAY = V[opB];
+    NEXT;
+
+op_set_sound:
 // set sound timer
-            debug("SET SOUND TIMER FROM V[%d]", opB);
-            if (sys->cb_set_timer_sound) sys->cb_set_timer_sound( sys->V[opB] );
-            break;
-        case 0x1E:
-//
-            debug("ADVANCE I TO BY V[%d]", opB);
-            sys->I += sys->V[opB];
-            break;
-        case 0x29:
-            debug("SET I TO DIGIT %d", opB);
-            if (sys->V[opB] > 15) {
-                sys->err = ILLEGAL_DIGIT;
-                return sys->err;
-            }
-            sys->I = sys->V[opB] * 5;
-            break;
-        case 0x33:
-        {
-            debug("WRITE BCD OF V[%d] TO I", opB);
-            if (sys->I > 4093) {
-                sys->err = INDEX_OVERFLOW;
-                return sys->err;
-            }
-            unsigned char value = sys->V[opB];
-            sys->RAM[sys->I + 2] = value % 10;
-            value /= 10;
-            sys->RAM[sys->I + 1] = value % 10;
-            value /= 10;
-            sys->RAM[sys->I] = value;
-            break;
+    debug("SET SOUND TIMER FROM V[%d]\n", opB);
+    PC += 2;
+    if (sys->cb.set_timer_sound) sys->cb.set_timer_sound(sys->ctx, V[opB]);
+    else sys->TIMER_SOUND = V[opB];
+    NEXT;
+
+op_add_i:
+    debug("ADVANCE I TO BY V[%d]\n", opB);
+    PC += 2;
+    I += V[opB];
+    NEXT;
+
+op_digit:
+    debug("SET I TO DIGIT %d\n", opB);
+    PC += 2;
+    if (V[opB] > 15) {
+        FAIL(ILLEGAL_DIGIT);
+    }
+    I = V[opB] * 5;
+    NEXT;
+
+op_bcd: {
+    debug("WRITE BCD OF V[%d] TO I\n", opB);
+    PC += 2;
+    if (I > 4093) {
+        FAIL(INDEX_OVERFLOW);
+    }
+    unsigned char value = V[opB];
+    sys->RAM[I + 2] = value % 10;
+    value /= 10;
+    sys->RAM[I + 1] = value % 10;
+    value /= 10;
+    sys->RAM[I] = value;
+    // self-modifying code support
+    invalidate(sys, I, 3);
+    NEXT;
+}
+
+op_store:
+    debug("STORE %d REGISTERS\n", opB);
+    PC += 2;
+    if (I + opB > 4095) {
+        FAIL(INDEX_OVERFLOW);
+    }
+    invalidate(sys, I, opB + 1);
+    for (int i = 0; i <= opB; i ++) {
+        sys->RAM[I] = V[i];
+        I ++;
+    }
+    NEXT;
+
+op_load:
+    debug("LOAD %d REGISTERS\n", opB);
+    PC += 2;
+    if (I + opB > 4095) {
+        FAIL(INDEX_OVERFLOW);
+    }
+    for (int i = 0; i <= opB; i ++) {
+        V[i] = sys->RAM[I];
+        I ++;
+    }
+    NEXT;
+
+op_illegal:
+    FAIL(ILLEGAL_INSTRUCTION);
+
+done:
+    sys->PC = PC;
+    sys->I = I;
+    memcpy(sys->V, V, sizeof(V));
+    sys->cycles += max_cycles - cycles;
+    return events;
+
+#undef FAIL
+#undef STOP
+#undef NEXT
+}
+
+// Runs one step of a machine
+//  returns 0 if OK or 1 if an error occurred
+int chip8_step(struct machine * sys)
+{
+    if (execute(sys, 1, 0))
+        return sys->err;
+    return 0;
+}
+
+// Runs many steps of a machine
+//  with the JIT on, native code runs whatever it translated and hands each
+//  instruction it did not back to the interpreter
+int chip8_run(struct machine * sys, unsigned int max_cycles, unsigned int stop_mask)
+{
+    if (! sys->jit || sys->AWAIT)
+        return execute(sys, max_cycles, stop_mask);
+
+    struct jit_regs regs;
+    regs.RAM = sys->RAM;
+
+    unsigned int cycles = max_cycles;
+    while (cycles) {
+        memcpy(regs.V, sys->V, sizeof(regs.V));
+        regs.I = sys->I;
+        regs.PC = sys->PC;
+        regs.budget = cycles;
+        regs.RNG = sys->RNG;
+
+        unsigned int ran = jit_run(sys->jit, &regs);
+        if (ran) {
+            memcpy(sys->V, regs.V, sizeof(sys->V));
+            sys->I = regs.I;
+            sys->PC = regs.PC;
+            sys->RNG = regs.RNG;
+            sys->cycles += ran;
+            cycles -= ran;
+            if (! cycles) break;
         }
-        case 0x55:
-            debug("STORE %d REGISTERS", opB);
-            if (sys->I + opB > 4095) {
-                sys->err = INDEX_OVERFLOW;
-                return sys->err;
-            }
-            for (int i = 0; i <= opB; i ++) {
-                sys->RAM[sys->I] = sys->V[i];
-                sys->I ++;
-            }
-            break;
-        case 0x65:
-            debug("LOAD %d REGISTERS", opB);
-            if (sys->I + opB > 4095) {
-                sys->err = INDEX_OVERFLOW;
-                return sys->err;
-            }
-            for (int i = 0; i <= opB; i ++) {
-                sys->V[i] = sys->RAM[sys->I];
-                sys->I ++;
-            }
-            break;
-        default:
-            sys->err = ILLEGAL_INSTRUCTION;
-            sys->PC -= 2;
-            return sys->err;
 
+        int events = execute(sys, 1, stop_mask);
+        if (events) return events;
+        cycles --;
+    }
+    return 0;
+}
+
+// Turns on native code for chip8_run
+int chip8_jit(struct machine * sys)
+{
+    if (! sys->jit)
+        sys->jit = jit_create();
+    return (sys->jit ? 0 : 1);
+}
+
+// Picks which quirks a machine follows
+void chip8_quirks(struct machine * sys, unsigned int quirks)
+{
+    sys->quirks = quirks;
+}
+
+// Runs one frame's steps and then the timers
+int chip8_run_frame(struct machine * sys, unsigned int ipf)
+{
+    // the VIP draws in step with the display: a sprite is the last
+    //  thing that happens in a frame
+    unsigned int stop_mask = (sys->quirks & CHIP8_QUIRK_DISPLAY_WAIT ? CHIP8_STOP_SPRITE : 0);
+
+    chip8_run(sys, ipf, stop_mask);
+    return chip8_tick(sys);
+}
+
+// Runs the built-in timers for one frame
+int chip8_tick(struct machine * sys)
+{
+    if (sys->TIMER_DELAY) sys->TIMER_DELAY --;
+    if (sys->TIMER_SOUND) sys->TIMER_SOUND --;
+    return (sys->TIMER_SOUND != 0);
+}
+
+// Seeds the machine's random number generator
+void chip8_seed(struct machine * sys, uint32_t seed)
+{
+    // xorshift never leaves 0
+    sys->RNG = (seed ? seed : 1);
+}
+
+// Sets a key on the built-in keypad
+//  while FX0A waits, a key pressed and then let go (as on the VIP) ends it
+void chip8_set_key(struct machine * sys, unsigned char key, unsigned char down)
+{
+    key &= 0xF;
+    if (sys->AWAIT) {
+        if (down && ! sys->KEYS[key]) {
+            sys->AWAIT_DOWN |= 1 << key;
+        } else if (! down && (sys->AWAIT_DOWN & (1 << key))) {
+            sys->V[sys->AWAIT & 0xF] = key;
+            sys->PC += 2;
+            sys->cycles ++;
+            sys->AWAIT = 0;
         }
-        debug("\n");
-        break;
     }
+    sys->KEYS[key] = down;
+}
 
-    return 0;
+// Hands over the rows changed since the last call
+uint32_t chip8_present(struct machine * sys, const uint64_t ** screen)
+{
+    uint32_t dirty = sys->DIRTY;
+    sys->DIRTY = 0;
+    *screen = sys->SCREEN;
+    return dirty;
+}
+
+// Captures the state of a machine
+void chip8_save(const struct machine * sys, struct chip8_state * state)
+{
+    // no stray padding bytes, so snapshots compare and delta cleanly
+    memset(state, 0, sizeof(struct chip8_state));
+
+    memcpy(state->SCREEN, sys->SCREEN, sizeof(state->SCREEN));
+    memcpy(state->RAM, sys->RAM, sizeof(state->RAM));
+    memcpy(state->V, sys->V, sizeof(state->V));
+    state->I = sys->I;
+    state->PC = sys->PC;
+    memcpy(state->STACK, sys->STACK, sizeof(state->STACK));
+    state->SP = sys->SP;
+    state->TIMER_DELAY = sys->TIMER_DELAY;
+    state->TIMER_SOUND = sys->TIMER_SOUND;
+    memcpy(state->KEYS, sys->KEYS, sizeof(state->KEYS));
+    state->AWAIT = sys->AWAIT;
+    state->AWAIT_DOWN = sys->AWAIT_DOWN;
+    state->RNG = sys->RNG;
+    state->err = sys->err;
+    state->cycles = sys->cycles;
+}
+
+// Puts a machine back in a saved state
+void chip8_restore(struct machine * sys, const struct chip8_state * state)
+{
+    // only the code that differs needs decoding again
+    for (unsigned short a = 0; a < 4096; a ++) {
+        if (sys->RAM[a] == state->RAM[a]) continue;
+
+        unsigned short start = a;
+        while (a < 4096 && sys->RAM[a] != state->RAM[a]) a ++;
+        invalidate(sys, start, a - start);
+    }
+
+    memcpy(sys->SCREEN, state->SCREEN, sizeof(sys->SCREEN));
+    sys->DIRTY = 0xFFFFFFFF;
+    memcpy(sys->RAM, state->RAM, sizeof(sys->RAM));
+    memcpy(sys->V, state->V, sizeof(sys->V));
+    sys->I = state->I;
+    sys->PC = state->PC;
+    memcpy(sys->STACK, state->STACK, sizeof(sys->STACK));
+    sys->SP = state->SP;
+    sys->TIMER_DELAY = state->TIMER_DELAY;
+    sys->TIMER_SOUND = state->TIMER_SOUND;
+    memcpy(sys->KEYS, state->KEYS, sizeof(sys->KEYS));
+    sys->AWAIT = state->AWAIT;
+    sys->AWAIT_DOWN = state->AWAIT_DOWN;
+    sys->RNG = state->RNG;
+    sys->err = state->err;
+    sys->cycles = state->cycles;
+
+    // a snapshot read back from a file may not hold together: past the end
+    //  of RAM the next step stops with PC_OVERFLOW, and a stack deeper than
+    //  the machine's is an overflow already
+    if (sys->PC >= CODE_SIZE)
+        sys->PC = 4095;
+    if (sys->SP > 16) {
+        sys->SP = 16;
+        sys->err = STACK_OVERFLOW;
+    }
+}
+
+// Steps run so far
+unsigned long chip8_cycles(const struct machine * sys)
+{
+    return sys->cycles;
+}
+
+unsigned short chip8_pc(const struct machine * sys)
+{
+    return sys->PC;
 }
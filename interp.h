@@ -1,28 +1,142 @@
 #ifndef INTERP_H_
 #define INTERP_H_
 
+#include <stdint.h>
+
 struct machine;
 
-// Create a new CHIP-8 machine - you have to pass all the required callbacks
-struct machine * chip8_create(
-    void (*cb_clear)(void),
-    void (*cb_plot)(unsigned char x, unsigned char y, unsigned char set),
-    unsigned char (*cb_get_timer_delay)(void),
-    void (*cb_set_timer_delay)(unsigned char value),
-    void (*cb_set_timer_sound)(unsigned char value),
-    unsigned char (*cb_check_key)(unsigned char key),
-    unsigned char (*cb_await_key)(void)
-);
+// error codes, as returned by chip8_error
+enum error {
+    NONE = 0,
+    PC_UNDERFLOW,
+    PC_OVERFLOW,
+    STACK_OVERFLOW,
+    STACK_UNDERFLOW,
+    INFINITE_LOOP,
+    ILLEGAL_INSTRUCTION,
+    ILLEGAL_DIGIT,
+    INDEX_OVERFLOW,
+    BAD_KEY
+};
+
+// hex digit sprites, loaded at address 0 (FX29 points I at digit * 5)
+extern const unsigned char chip8_font[0x10 * 5];
+
+// Callbacks from a machine to its frontend
+//  every callback gets the ctx pointer that was passed to chip8_create
+//  any of them may be NULL:
+//  - clear / plot: nothing is called, draw from chip8_present instead
+//  - timers: the machine keeps its own, run them with chip8_tick
+//  - check_key: the machine keeps its own keypad, set it with chip8_set_key
+//  - await_key: FX0A waits inside the machine for a key on its own keypad;
+//    chip8_run returns CHIP8_STOP_WAIT until chip8_set_key supplies one
+struct chip8_callbacks {
+    void (*clear)(void * ctx);
+    void (*plot)(void * ctx, unsigned char x, unsigned char y, unsigned char set);
+    unsigned char (*get_timer_delay)(void * ctx);
+    void (*set_timer_delay)(void * ctx, unsigned char value);
+    void (*set_timer_sound)(void * ctx, unsigned char value);
+    unsigned char (*check_key)(void * ctx, unsigned char key);
+    unsigned char (*await_key)(void * ctx);
+};
+
+// Create a new CHIP-8 machine
+//  cb is copied, and may be NULL to use only the built-in state
+struct machine * chip8_create(const struct chip8_callbacks * cb, void * ctx);
 
 // load a chip8 program into RAM
-void chip8_load(struct machine * sys, const unsigned char * rom, unsigned short size);
+//  returns 0 if OK or 1 if the program does not fit
+int chip8_load(struct machine * sys, const unsigned char * rom, unsigned short size);
 
 // Runs one step of a machine
 int chip8_step(struct machine * sys);
 
+// Reasons for chip8_run to return early
+#define CHIP8_STOP_ERROR 0x01   // an error occurred (always stops)
+#define CHIP8_STOP_DRAW  0x02   // the screen changed (DXYN or 00E0)
+#define CHIP8_STOP_KEY   0x04   // FX0A finished waiting for a key
+#define CHIP8_STOP_SPRITE 0x08  // a sprite was drawn (DXYN, not 00E0)
+#define CHIP8_STOP_WAIT  0x10   // FX0A is waiting for a key (always stops)
+
+// Runs up to max_cycles steps of a machine, returning early after any
+//  event in stop_mask
+//  returns the CHIP8_STOP_* event that ended the run, or 0 if the cycles ran out
+int chip8_run(struct machine * sys, unsigned int max_cycles, unsigned int stop_mask);
+
+// Turns on the JIT (x86-64 only) for chip8_run; chip8_step always interprets
+//  returns 0 if OK or 1 if there is no JIT here
+int chip8_jit(struct machine * sys);
+
+// Quirks: behaviour that differs between CHIP-8 implementations
+//  off by default
+#define CHIP8_QUIRK_DISPLAY_WAIT 0x01   // DXYN waits for the next frame, as on the COSMAC VIP
+
+void chip8_quirks(struct machine * sys, unsigned int quirks);
+
+// Runs one 60 Hz frame: ipf steps (fewer if a display wait or an error ends
+//  it early), then the built-in timers
+//  returns nonzero while the sound timer is running; see chip8_error for errors
+int chip8_run_frame(struct machine * sys, unsigned int ipf);
+
+// Runs the built-in timers for one frame (call at 60 Hz)
+//  returns nonzero while the sound timer is running
+int chip8_tick(struct machine * sys);
+
+// Seeds the generator behind CXNN (each machine has its own, seeded 1)
+//  the same seed and inputs always give the same run
+void chip8_seed(struct machine * sys, uint32_t seed);
+
+// Presses (down = 1) or releases (down = 0) a key on the built-in keypad
+//  if FX0A is waiting, a key pressed and then released during the wait
+//  finishes it
+void chip8_set_key(struct machine * sys, unsigned char key, unsigned char down);
+
+// Hands the frontend the screen, once per frame
+//  screen is set to 32 rows of 64 pixels each, leftmost pixel in the top bit
+//  returns a mask of the rows changed since the last call (bit N = row N)
+uint32_t chip8_present(struct machine * sys, const uint64_t ** screen);
+
+// A flat snapshot of everything a machine runs on
+//  (the callbacks, ctx and caches are not part of it)
+//  plain data: it can be copied, compared or written out as it is
+struct chip8_state {
+    uint64_t SCREEN[32];
+    unsigned char RAM[4096];
+    unsigned char V[16];
+    unsigned short I;
+    unsigned short PC;
+    unsigned short STACK[16];
+    unsigned char SP;
+    unsigned char TIMER_DELAY;
+    unsigned char TIMER_SOUND;
+    unsigned char KEYS[16];
+    unsigned char err;
+    unsigned char AWAIT;
+    uint16_t AWAIT_DOWN;
+    uint32_t RNG;
+    uint64_t cycles;
+};
+
+// Captures the state of a machine
+void chip8_save(const struct machine * sys, struct chip8_state * state);
+
+// Puts a machine back in a saved state
+//  the whole screen is reported changed at the next chip8_present
+//  a PC or SP out of range is kept in bounds and ends in an error instead
+void chip8_restore(struct machine * sys, const struct chip8_state * state);
+
+// Number of steps a machine has run
+unsigned long chip8_cycles(const struct machine * sys);
+
+// Address of the next instruction a machine will run
+unsigned short chip8_pc(const struct machine * sys);
+
 // Frees a machine
 void chip8_destroy(struct machine * sys);
 
 void chip8_perror(const struct machine * sys);
 
+// The error a machine stopped with, or 0 if none
+int chip8_error(const struct machine * sys);
+
 #endif
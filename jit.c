@@ -0,0 +1,434 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+// executable memory for all blocks; when it fills up everything is dropped
+#define ARENA_SIZE (1 << 20)
+
+// longest block, in instructions, and the most code one may need: every
+//  instruction as long as the longest one (FF65, 178 bytes), plus the
+//  budget check, the exits and the out path
+#define BLOCK_MAX 64
+#define INSN_ROOM 192
+#define BLOCK_ROOM (BLOCK_MAX * INSN_ROOM + 128)
+
+#define MAX_BLOCKS 4096
+#define MAX_LINKS 8192
+
+// native code keeps a struct jit_regs * in rbx and RAM in r12
+//  these are the rbx-relative (disp8) offsets of the registers
+#define R_V(x) (offsetof(struct jit_regs, V) + (x))
+#define R_I offsetof(struct jit_regs, I)
+#define R_PC offsetof(struct jit_regs, PC)
+#define R_BUDGET offsetof(struct jit_regs, budget)
+#define R_RAM offsetof(struct jit_regs, RAM)
+#define R_RNG offsetof(struct jit_regs, RNG)
+
+// a translated block
+//  head starts with the budget check, which is overwritten with a jump to
+//  out (an exit back to the interpreter at start) to kill the block
+struct block {
+    unsigned short start;
+    unsigned short end;     // one past the last byte translated
+    unsigned char * head;
+    unsigned char * out;
+};
+
+// an exit to an address with no block yet, made into a direct jump once
+//  a block is translated there
+struct link {
+    unsigned short target;
+    unsigned char * site;
+};
+
+struct jit {
+    unsigned char * arena;
+    unsigned char * base;   // first byte after the entry / exit code
+    unsigned char * top;    // next free byte
+
+    void (*enter)(struct jit_regs * regs, const unsigned char * head);
+    unsigned char * leave;
+
+    // live block heads by address
+    unsigned char * code[4096];
+    // bytes translated into some block since the last flush
+    unsigned char covered[4096];
+
+    struct block blocks[MAX_BLOCKS];
+    unsigned int block_count;
+
+    struct link links[MAX_LINKS];
+    unsigned int link_count;
+};
+
+// machine code output
+#define EMIT(...) do { \
+        const unsigned char bytes_[] = { __VA_ARGS__ }; \
+        memcpy(p, bytes_, sizeof(bytes_)); \
+        p += sizeof(bytes_); \
+    } while (0)
+
+#define IMM16(v) ((v) & 0xFF), (((v) >> 8) & 0xFF)
+#define IMM32(v) ((v) & 0xFF), (((v) >> 8) & 0xFF), (((v) >> 16) & 0xFF), (((v) >> 24) & 0xFF)
+
+// point the rel32 at site (the last 4 bytes of a jump) at to
+static void patch(unsigned char * site, const unsigned char * to)
+{
+    int32_t rel = to - (site + 4);
+    memcpy(site, &rel, sizeof(rel));
+}
+
+// jmp rel32
+static unsigned char * jump(unsigned char * p, const unsigned char * to)
+{
+    EMIT(0xE9, IMM32(0));
+    patch(p - 4, to);
+    return p;
+}
+
+// leave native code with PC = target, or go straight on to its block
+static unsigned char * exit_to(struct jit * jit, unsigned char * p, unsigned short target)
+{
+    if (target < 4096 && jit->code[target])
+        return jump(p, jit->code[target]);
+
+    if (target >= 0x200 && target < 4095 && jit->link_count < MAX_LINKS) {
+        jit->links[jit->link_count].target = target;
+        jit->links[jit->link_count].site = p;
+        jit->link_count ++;
+    }
+
+    // mov word [rbx + PC], target
+    EMIT(0x66, 0xC7, 0x43, R_PC, IMM16(target));
+    return jump(p, jit->leave);
+}
+
+// Whether the instruction at pc goes into native code
+//  anything that can fail, draws, writes RAM, waits or calls back to the
+//  frontend is left to the interpreter
+static int translatable(unsigned short pc, unsigned short op)
+{
+    if (pc < 0x200 || pc >= 4095)
+        return 0;
+
+    switch ((op & 0xF000) >> 12) {
+    case 1:
+        return (op & 0x0FFF) != pc;
+    case 3: case 4: case 6: case 7: case 0xA: case 0xB: case 0xC:
+        return 1;
+    case 5: case 9:
+        return (op & 0x000F) == 0;
+    case 8:
+        return (op & 0x000F) <= 7 || (op & 0x000F) == 0xE;
+    case 0xF:
+        return (op & 0x00FF) == 0x1E || (op & 0x00FF) == 0x65;
+    }
+    return 0;
+}
+
+// Translates the block starting at start, returning its head
+static unsigned char * compile(struct jit * jit, const unsigned char * RAM, unsigned short start)
+{
+    if (! translatable(start, (RAM[start] << 8) | RAM[start + 1]))
+        return NULL;
+
+    if (jit->top + BLOCK_ROOM > jit->arena + ARENA_SIZE || jit->block_count == MAX_BLOCKS)
+        jit_flush(jit);
+
+    unsigned char * head = jit->top;
+    unsigned char * p = head;
+
+    // run the block only if all of its steps fit in the budget
+    //  cmp dword [rbx + budget], n; jb out; sub dword [rbx + budget], n
+    EMIT(0x81, 0x7B, R_BUDGET, IMM32(0));
+    unsigned char * check = p - 4;
+    EMIT(0x0F, 0x82, IMM32(0));
+    unsigned char * to_out = p - 4;
+    EMIT(0x81, 0x6B, R_BUDGET, IMM32(0));
+    unsigned char * charge = p - 4;
+
+    // side exits give back the steps they did not run
+    unsigned char * refund[BLOCK_MAX];
+    unsigned int refund_at[BLOCK_MAX];
+    unsigned int refunds = 0;
+
+    unsigned short pc = start;
+    unsigned int n = 0;
+    int open = 1;
+    while (open) {
+        unsigned short op = (pc < 4095 ? (RAM[pc] << 8) | RAM[pc + 1] : 0);
+        if (n == BLOCK_MAX || ! translatable(pc, op)) {
+            p = exit_to(jit, p, pc);
+            break;
+        }
+
+        unsigned char x = (op & 0x0F00) >> 8;
+        unsigned char y = (op & 0x00F0) >> 4;
+        unsigned char nn = op & 0x00FF;
+        unsigned short nnn = op & 0x0FFF;
+        n ++;
+
+        switch ((op & 0xF000) >> 12) {
+        case 1:
+            p = exit_to(jit, p, nnn);
+            open = 0;
+            break;
+        case 3: case 4: case 5: case 9: {
+            if ((op & 0xF000) == 0x3000 || (op & 0xF000) == 0x4000) {
+                // cmp byte [V[x]], nn
+                EMIT(0x80, 0x7B, R_V(x), nn);
+            } else {
+                // mov al, [V[x]]; cmp al, [V[y]]
+                EMIT(0x8A, 0x43, R_V(x), 0x3A, 0x43, R_V(y));
+            }
+            // je / jne to the skip
+            if ((op & 0xF000) == 0x3000 || (op & 0xF000) == 0x5000)
+                EMIT(0x0F, 0x84, IMM32(0));
+            else
+                EMIT(0x0F, 0x85, IMM32(0));
+            unsigned char * skip = p - 4;
+            p = exit_to(jit, p, pc + 2);
+            patch(skip, p);
+            p = exit_to(jit, p, pc + 4);
+            open = 0;
+            break;
+        }
+        case 6:
+            // mov byte [V[x]], nn
+            EMIT(0xC6, 0x43, R_V(x), nn);
+            break;
+        case 7:
+            // add byte [V[x]], nn
+            EMIT(0x80, 0x43, R_V(x), nn);
+            break;
+        case 8:
+            switch (op & 0x000F) {
+            case 0:
+                // mov al, [V[y]]; mov [V[x]], al
+                EMIT(0x8A, 0x43, R_V(y), 0x88, 0x43, R_V(x));
+                break;
+            case 1: case 2: case 3:
+                // mov al, [V[x]]; or / and / xor al, [V[y]]
+                EMIT(0x8A, 0x43, R_V(x));
+                EMIT((op & 0x000F) == 1 ? 0x0A : (op & 0x000F) == 2 ? 0x22 : 0x32, 0x43, R_V(y));
+                // mov [V[x]], al; mov byte [V[F]], 0
+                EMIT(0x88, 0x43, R_V(x), 0xC6, 0x43, R_V(0xF), 0);
+                break;
+            case 4: case 5: case 7:
+                // mov al, [first]; add / sub al, [second]; setc / setnc dl
+                if ((op & 0x000F) == 7)
+                    EMIT(0x8A, 0x43, R_V(y), 0x2A, 0x43, R_V(x), 0x0F, 0x93, 0xC2);
+                else if ((op & 0x000F) == 5)
+                    EMIT(0x8A, 0x43, R_V(x), 0x2A, 0x43, R_V(y), 0x0F, 0x93, 0xC2);
+                else
+                    EMIT(0x8A, 0x43, R_V(x), 0x02, 0x43, R_V(y), 0x0F, 0x92, 0xC2);
+                // mov [V[x]], al; mov [V[F]], dl
+                EMIT(0x88, 0x43, R_V(x), 0x88, 0x53, R_V(0xF));
+                break;
+            case 6:
+                // mov al, [V[y]]; mov dl, al; and dl, 1; shr al, 1
+                EMIT(0x8A, 0x43, R_V(y), 0x88, 0xC2, 0x80, 0xE2, 0x01, 0xD0, 0xE8);
+                EMIT(0x88, 0x43, R_V(x), 0x88, 0x53, R_V(0xF));
+                break;
+            case 0xE:
+                // mov al, [V[y]]; mov dl, al; shr dl, 7; shl al, 1
+                EMIT(0x8A, 0x43, R_V(y), 0x88, 0xC2, 0xC0, 0xEA, 0x07, 0xD0, 0xE0);
+                EMIT(0x88, 0x43, R_V(x), 0x88, 0x53, R_V(0xF));
+                break;
+            }
+            break;
+        case 0xA:
+            // mov word [I], nnn
+            EMIT(0x66, 0xC7, 0x43, R_I, IMM16(nnn));
+            break;
+        case 0xB:
+            // movzx eax, byte [V[0]]; add eax, nnn; mov [PC], ax; leave
+            EMIT(0x0F, 0xB6, 0x43, R_V(0), 0x05, IMM32(nnn), 0x66, 0x89, 0x43, R_PC);
+            p = jump(p, jit->leave);
+            open = 0;
+            break;
+        case 0xC: {
+            // the interpreter's xorshift32, inline
+            //  mov eax, [RNG]; then for each shift: mov edx, eax; shl/shr edx, n; xor eax, edx
+            EMIT(0x8B, 0x43, R_RNG);
+            EMIT(0x89, 0xC2, 0xC1, 0xE2, 13, 0x31, 0xD0);
+            EMIT(0x89, 0xC2, 0xC1, 0xEA, 17, 0x31, 0xD0);
+            EMIT(0x89, 0xC2, 0xC1, 0xE2, 5, 0x31, 0xD0);
+            // mov [RNG], eax; shr eax, 24; and al, nn; mov [V[x]], al
+            EMIT(0x89, 0x43, R_RNG, 0xC1, 0xE8, 24);
+            EMIT(0x24, nn, 0x88, 0x43, R_V(x));
+            break;
+        }
+        case 0xF:
+            if (nn == 0x1E) {
+                // movzx eax, byte [V[x]]; add [I], ax
+                EMIT(0x0F, 0xB6, 0x43, R_V(x), 0x66, 0x01, 0x43, R_I);
+            } else {
+                // FX65: movzx eax, word [I]; cmp eax, 4095 - x; jbe ok
+                EMIT(0x0F, 0xB7, 0x43, R_I, 0x3D, IMM32(4095 - x), 0x76, 18);
+                // out of range: the interpreter raises the error
+                //  add dword [budget], refund; mov word [PC], pc; jmp leave
+                EMIT(0x81, 0x43, R_BUDGET, IMM32(0));
+                refund[refunds] = p - 4;
+                refund_at[refunds ++] = n - 1;
+                EMIT(0x66, 0xC7, 0x43, R_PC, IMM16(pc));
+                p = jump(p, jit->leave);
+                // ok: movzx ecx, byte [r12 + rax + i]; mov [V[i]], cl
+                for (int i = 0; i <= x; i ++)
+                    EMIT(0x41, 0x0F, 0xB6, 0x4C, 0x04, i, 0x88, 0x4B, R_V(i));
+                // add word [I], x + 1
+                EMIT(0x66, 0x83, 0x43, R_I, x + 1);
+            }
+            break;
+        }
+        pc += 2;
+    }
+
+    // out: mov word [PC], start; jmp leave
+    unsigned char * out = p;
+    EMIT(0x66, 0xC7, 0x43, R_PC, IMM16(start));
+    p = jump(p, jit->leave);
+    patch(to_out, out);
+
+    memcpy(check, &n, sizeof(n));
+    memcpy(charge, &n, sizeof(n));
+    for (unsigned int i = 0; i < refunds; i ++) {
+        uint32_t steps = n - refund_at[i];
+        memcpy(refund[i], &steps, sizeof(steps));
+    }
+    jit->top = p;
+
+    // register the block, and send waiting exits to it
+    struct block * b = &jit->blocks[jit->block_count ++];
+    b->start = start;
+    b->end = pc + 2;
+    b->head = head;
+    b->out = out;
+    memset(&jit->covered[start], 1, (b->end < 4096 ? b->end : 4096) - start);
+    jit->code[start] = head;
+
+    for (unsigned int i = 0; i < jit->link_count; ) {
+        if (jit->links[i].target == start) {
+            jump(jit->links[i].site, head);
+            jit->links[i] = jit->links[-- jit->link_count];
+        } else {
+            i ++;
+        }
+    }
+
+    return head;
+}
+
+struct jit * jit_create(void)
+{
+    unsigned char * arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED)
+        return NULL;
+
+    struct jit * jit = malloc(sizeof(struct jit));
+    jit->arena = arena;
+
+    unsigned char * p = arena;
+
+    // enter(regs, head): push rbx; push r12; mov rbx, rdi;
+    //  mov r12, [rdi + RAM]; jmp rsi
+    jit->enter = (void (*)(struct jit_regs *, const unsigned char *)) p;
+    EMIT(0x53, 0x41, 0x54);
+    EMIT(0x48, 0x89, 0xFB, 0x4C, 0x8B, 0x67, R_RAM, 0xFF, 0xE6);
+
+    // leave: pop r12; pop rbx; ret
+    jit->leave = p;
+    EMIT(0x41, 0x5C, 0x5B, 0xC3);
+
+    jit->base = p;
+    jit_flush(jit);
+
+    return jit;
+}
+
+void jit_destroy(struct jit * jit)
+{
+    munmap(jit->arena, ARENA_SIZE);
+    free(jit);
+}
+
+unsigned int jit_run(struct jit * jit, struct jit_regs * regs)
+{
+    unsigned short pc = regs->PC;
+    if (pc < 0x200 || pc >= 4095)
+        return 0;
+
+    unsigned char * head = jit->code[pc];
+    if (! head && ! (head = compile(jit, regs->RAM, pc)))
+        return 0;
+
+    uint32_t budget = regs->budget;
+    jit->enter(regs, head);
+    return budget - regs->budget;
+}
+
+void jit_invalidate(struct jit * jit, unsigned short addr, unsigned short size)
+{
+    unsigned int end = addr + size;
+    if (end > 4096) end = 4096;
+    if (! memchr(&jit->covered[addr], 1, end - addr))
+        return;
+
+    for (unsigned int i = 0; i < jit->block_count; ) {
+        struct block * b = &jit->blocks[i];
+        if (b->start < end && b->end > addr) {
+            // anything still jumping to the head now leaves instead
+            unsigned char * p = b->head;
+            jump(p, b->out);
+            if (jit->code[b->start] == b->head)
+                jit->code[b->start] = NULL;
+            *b = jit->blocks[-- jit->block_count];
+        } else {
+            i ++;
+        }
+    }
+}
+
+void jit_flush(struct jit * jit)
+{
+    jit->top = jit->base;
+    memset(jit->code, 0, sizeof(jit->code));
+    memset(jit->covered, 0, sizeof(jit->covered));
+    jit->block_count = 0;
+    jit->link_count = 0;
+}
+
+#else
+
+// no JIT on this platform: the interpreter does everything
+struct jit * jit_create(void)
+{
+    return NULL;
+}
+
+void jit_destroy(struct jit * jit)
+{
+}
+
+unsigned int jit_run(struct jit * jit, struct jit_regs * regs)
+{
+    return 0;
+}
+
+void jit_invalidate(struct jit * jit, unsigned short addr, unsigned short size)
+{
+}
+
+void jit_flush(struct jit * jit)
+{
+}
+
+#endif
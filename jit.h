@@ -0,0 +1,41 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <stdint.h>
+
+// Basic-block JIT for interp.c (x86-64 only)
+//  translates runs of register-only instructions into native code, chains
+//  the blocks together and leaves everything else to the interpreter
+
+struct jit;
+
+// the registers native code runs on
+//  copied in and out of the machine around each jit_run
+struct jit_regs {
+    unsigned char V[16];
+    unsigned short I;
+    unsigned short PC;
+    // steps left: a block only runs if all of its steps fit
+    uint32_t budget;
+    const unsigned char * RAM;
+    // CXNN generator state
+    uint32_t RNG;
+};
+
+// returns NULL where there is no JIT (not x86-64, or no executable memory)
+struct jit * jit_create(void);
+
+void jit_destroy(struct jit * jit);
+
+// Runs native code from regs->PC until the budget runs out or it reaches
+//  an instruction it leaves to the interpreter
+//  returns the number of steps run (0 if none could be)
+unsigned int jit_run(struct jit * jit, struct jit_regs * regs);
+
+// Drops blocks translated from any of the size bytes at addr
+void jit_invalidate(struct jit * jit, unsigned short addr, unsigned short size);
+
+// Drops all blocks
+void jit_flush(struct jit * jit);
+
+#endif
@@ -0,0 +1,40 @@
+#include <string.h>
+
+#include "keypad.h"
+
+void keypad_init(struct keypad * kp, unsigned char hold_frames)
+{
+    kp->down = 0;
+    kp->latched = 0;
+    memset(kp->hold, 0, sizeof(kp->hold));
+    kp->hold_frames = (hold_frames ? hold_frames : 1);
+}
+
+void keypad_event(struct keypad * kp, unsigned int key, int down, int releases)
+{
+    if (key >= KEYPAD_KEYS) return;
+    uint32_t bit = (uint32_t) 1 << key;
+
+    if (down) {
+        kp->down |= bit;
+        kp->latched |= bit;
+        // a press with no release coming: hold it instead
+        kp->hold[key] = (releases ? 0 : kp->hold_frames);
+    } else if (releases) {
+        kp->down &= ~bit;
+        kp->hold[key] = 0;
+    }
+}
+
+uint32_t keypad_frame(struct keypad * kp)
+{
+    uint32_t state = kp->down | kp->latched;
+    kp->latched = 0;
+
+    for (unsigned int key = 0; key < KEYPAD_KEYS; key ++) {
+        if (kp->hold[key] && ! -- kp->hold[key])
+            kp->down &= ~((uint32_t) 1 << key);
+    }
+
+    return state;
+}
@@ -0,0 +1,35 @@
+#ifndef KEYPAD_H_
+#define KEYPAD_H_
+
+#include <stdint.h>
+
+// Key state for the terminal frontends, from a stream of key events
+//  on terminals that report releases a key is down from its press to its
+//  release; elsewhere each press holds it down for a fixed number of
+//  frames (renewed by autorepeat)
+//  a key pressed and released between two frames still reads as down for
+//  one frame, so no press is lost
+
+// up to 32 keys: the hex keypad is 0-15, frontends may add their own above
+#define KEYPAD_KEYS 32
+
+struct keypad {
+    uint32_t down;
+    // pressed since the last frame
+    uint32_t latched;
+    // frames left on each key's hold, when releases are not reported
+    unsigned char hold[KEYPAD_KEYS];
+    unsigned char hold_frames;
+};
+
+void keypad_init(struct keypad * kp, unsigned char hold_frames);
+
+// a key went down (down = 1) or up (down = 0)
+//  releases says whether the terminal reports them; if not, a press is
+//  held for hold_frames and releases are ignored
+void keypad_event(struct keypad * kp, unsigned int key, int down, int releases);
+
+// the keys down this frame, then ages holds and latches for the next
+uint32_t keypad_frame(struct keypad * kp);
+
+#endif
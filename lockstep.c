@@ -0,0 +1,673 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "interp.h"
+#include "lockstep.h"
+
+// lane counts are rounded up to a whole number of these, so the lane loops
+//  below never need a scalar tail and every array stays cache line aligned
+#define LANE_BLOCK 64
+
+// a group is run across all lanes at once when it holds at least
+//  1 / VECTOR_RATIO of them, otherwise its lanes are stepped one at a time
+#define VECTOR_RATIO 32
+
+// once this many groups in one step turned out too small, the lanes have
+//  diverged: step the rest one at a time rather than keep searching
+#define MISS_LIMIT 4
+
+struct lockstep {
+    // lanes allocated (a multiple of LANE_BLOCK), and lanes in use
+    unsigned int lanes;
+    unsigned int count;
+
+    // registers, struct-of-arrays: V[x][lane], STACK[depth][lane]
+    uint8_t * V[16];
+    uint16_t * I;
+    uint16_t * PC;
+    uint16_t * STACK[16];
+    uint8_t * SP;
+
+    // built-in timers, keypad (one bit per key) and CXNN generator
+    uint8_t * TIMER_DELAY;
+    uint8_t * TIMER_SOUND;
+    uint16_t * KEYS;
+    uint32_t * RNG;
+
+    // FX0A with no await_key callback: 0x10 | x while waiting for a key,
+    //  and the keys pressed since it started
+    uint8_t * AWAIT;
+    uint16_t * AWAIT_DOWN;
+
+    // per-lane memory, one lane after another
+    uint8_t * RAM;          // RAM[lane * 4096 + addr]
+    uint64_t * SCREEN;      // SCREEN[lane * 32 + row]
+    uint32_t * DIRTY;
+
+    // addresses any lane has written to since the ROM was loaded: while
+    //  both bytes at a pc are untouched, every lane has the same opcode there
+    uint8_t TOUCHED[4096];
+
+    unsigned long * cycles;
+    uint8_t * err;
+
+    // lane masks (0xFF or 0) used while running
+    uint8_t * run;          // still running this lockstep_run
+    uint8_t * todo;         // not yet stepped this step
+    uint8_t * group;        // stepping together right now
+
+    unsigned char (*await_key)(void * ctx, unsigned int lane);
+    void * ctx;
+};
+
+static void * lane_array(unsigned int lanes, size_t size)
+{
+    void * p = aligned_alloc(LANE_BLOCK, lanes * size);
+    memset(p, 0, lanes * size);
+    return p;
+}
+
+// Create lanes machines
+struct lockstep * lockstep_create(unsigned int lanes,
+                                  unsigned char (*await_key)(void * ctx, unsigned int lane),
+                                  void * ctx)
+{
+    struct lockstep * ls = malloc(sizeof(struct lockstep));
+
+    ls->count = lanes;
+    ls->lanes = (lanes + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK;
+    if (ls->lanes == 0) ls->lanes = LANE_BLOCK;
+    lanes = ls->lanes;
+
+    for (int i = 0; i < 16; i ++) {
+        ls->V[i] = lane_array(lanes, sizeof(uint8_t));
+        ls->STACK[i] = lane_array(lanes, sizeof(uint16_t));
+    }
+    ls->I = lane_array(lanes, sizeof(uint16_t));
+    ls->PC = lane_array(lanes, sizeof(uint16_t));
+    ls->SP = lane_array(lanes, sizeof(uint8_t));
+
+    ls->TIMER_DELAY = lane_array(lanes, sizeof(uint8_t));
+    ls->TIMER_SOUND = lane_array(lanes, sizeof(uint8_t));
+    ls->KEYS = lane_array(lanes, sizeof(uint16_t));
+    ls->RNG = lane_array(lanes, sizeof(uint32_t));
+    ls->AWAIT = lane_array(lanes, sizeof(uint8_t));
+    ls->AWAIT_DOWN = lane_array(lanes, sizeof(uint16_t));
+
+    ls->RAM = lane_array(lanes, 4096);
+    ls->SCREEN = lane_array(lanes, 32 * sizeof(uint64_t));
+    ls->DIRTY = lane_array(lanes, sizeof(uint32_t));
+
+    ls->cycles = lane_array(lanes, sizeof(unsigned long));
+    ls->err = lane_array(lanes, sizeof(uint8_t));
+
+    ls->run = lane_array(lanes, sizeof(uint8_t));
+    ls->todo = lane_array(lanes, sizeof(uint8_t));
+    ls->group = lane_array(lanes, sizeof(uint8_t));
+
+    for (unsigned int l = 0; l < lanes; l ++) {
+        memcpy(&ls->RAM[(size_t) l * 4096], chip8_font, sizeof(chip8_font));
+        ls->PC[l] = 0x200;
+        ls->DIRTY[l] = 0xFFFFFFFF;
+        ls->RNG[l] = 1;
+    }
+
+    memset(ls->TOUCHED, 0, sizeof(ls->TOUCHED));
+
+    ls->await_key = await_key;
+    ls->ctx = ctx;
+
+    return ls;
+}
+
+// load the same program into every lane
+int lockstep_load(struct lockstep * ls, const unsigned char * rom_data, const unsigned short rom_size)
+{
+    if (rom_size > 4096 - 0x200)
+        return 1;
+
+    for (unsigned int l = 0; l < ls->lanes; l ++)
+        memcpy(&ls->RAM[(size_t) l * 4096 + 0x200], rom_data, rom_size);
+    memset(ls->TOUCHED, 0, sizeof(ls->TOUCHED));
+    return 0;
+}
+
+void lockstep_seed(struct lockstep * ls, unsigned int lane, uint32_t seed)
+{
+    // xorshift never leaves 0
+    ls->RNG[lane] = (seed ? seed : 1);
+}
+
+void lockstep_destroy(struct lockstep * ls)
+{
+    for (int i = 0; i < 16; i ++) {
+        free(ls->V[i]);
+        free(ls->STACK[i]);
+    }
+    free(ls->I);
+    free(ls->PC);
+    free(ls->SP);
+    free(ls->TIMER_DELAY);
+    free(ls->TIMER_SOUND);
+    free(ls->KEYS);
+    free(ls->RNG);
+    free(ls->AWAIT);
+    free(ls->AWAIT_DOWN);
+    free(ls->RAM);
+    free(ls->SCREEN);
+    free(ls->DIRTY);
+    free(ls->cycles);
+    free(ls->err);
+    free(ls->run);
+    free(ls->todo);
+    free(ls->group);
+    free(ls);
+}
+
+static inline unsigned short fetch(const struct lockstep * ls, unsigned int lane, unsigned short pc)
+{
+    const uint8_t * ram = &ls->RAM[(size_t) lane * 4096];
+    return (ram[pc] << 8) | ram[pc + 1];
+}
+
+// xorshift32, one generator per lane
+static inline uint32_t next_rand(uint32_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// Runs one instruction on every lane in the group mask m, all at once
+//  every loop here covers all the lanes and keeps the lanes outside the
+//  group as they were, so it compiles down to straight vector code
+//  returns 0 (having done nothing) for instructions that can stop a lane
+//  or touch per-lane memory, which are left to step_lane
+static int step_group(struct lockstep * ls, unsigned short pc, unsigned short op, const uint8_t * m)
+{
+    const unsigned int lanes = ls->lanes;
+
+    uint8_t * VX = ls->V[(op & 0x0F00) >> 8];
+    uint8_t * VY = ls->V[(op & 0x00F0) >> 4];
+    uint8_t * VF = ls->V[0xF];
+    uint16_t * PC = ls->PC;
+    const uint8_t nn = op & 0x00FF;
+    const uint16_t nnn = op & 0x0FFF;
+
+// new value where the lane is in the group, old value elsewhere
+#define BLEND(old, new) (((old) & ~m[l]) | ((new) & m[l]))
+
+// one loop over all lanes
+#define LANES(body) do { \
+        for (unsigned int l = 0; l < lanes; l ++) { body; } \
+    } while (0)
+
+// 8XY_ instructions: set VX, then VF
+#define ALU(result, flag) LANES( \
+        uint8_t x = VX[l]; uint8_t y = VY[l]; \
+        (void) x; (void) y; \
+        VX[l] = BLEND(x, (uint8_t) (result)); \
+        VF[l] = BLEND(VF[l], (uint8_t) (flag)); \
+        PC[l] += m[l] & 2)
+
+    switch ((op & 0xF000) >> 12) {
+    case 1:
+        // a jump to itself is an error
+        if (nnn == pc) return 0;
+        LANES(PC[l] = (m[l] ? nnn : PC[l]));
+        break;
+    case 3:
+        LANES(PC[l] += m[l] & (VX[l] == nn ? 4 : 2));
+        break;
+    case 4:
+        LANES(PC[l] += m[l] & (VX[l] != nn ? 4 : 2));
+        break;
+    case 5:
+        if (op & 0x000F) return 0;
+        LANES(PC[l] += m[l] & (VX[l] == VY[l] ? 4 : 2));
+        break;
+    case 6:
+        LANES(VX[l] = BLEND(VX[l], nn); PC[l] += m[l] & 2);
+        break;
+    case 7:
+        LANES(VX[l] = BLEND(VX[l], (uint8_t) (VX[l] + nn)); PC[l] += m[l] & 2);
+        break;
+    case 8:
+        switch (op & 0x000F) {
+        case 0:
+            LANES(VX[l] = BLEND(VX[l], VY[l]); PC[l] += m[l] & 2);
+            break;
+        case 1: ALU(x | y, 0); break;
+        case 2: ALU(x & y, 0); break;
+        case 3: ALU(x ^ y, 0); break;
+        case 4: ALU(x + y, (x + y) > 255); break;
+        case 5: ALU(x - y, x >= y); break;
+        case 6: ALU(y >> 1, y & 1); break;
+        case 7: ALU(y - x, y >= x); break;
+        case 0xE: ALU(y << 1, y >> 7); break;
+        default: return 0;
+        }
+        break;
+    case 9:
+        if (op & 0x000F) return 0;
+        LANES(PC[l] += m[l] & (VX[l] != VY[l] ? 4 : 2));
+        break;
+    case 0xA:
+        LANES(ls->I[l] = (m[l] ? nnn : ls->I[l]); PC[l] += m[l] & 2);
+        break;
+    case 0xC: {
+        uint32_t * RNG = ls->RNG;
+        LANES(
+            uint32_t r = next_rand(RNG[l]);
+            RNG[l] = (m[l] ? r : RNG[l]);
+            VX[l] = BLEND(VX[l], (uint8_t) (r >> 24) & nn);
+            PC[l] += m[l] & 2);
+        break;
+    }
+    case 0xF:
+        switch (nn) {
+        case 0x07:
+            LANES(VX[l] = BLEND(VX[l], ls->TIMER_DELAY[l]); PC[l] += m[l] & 2);
+            break;
+        case 0x15:
+            LANES(ls->TIMER_DELAY[l] = BLEND(ls->TIMER_DELAY[l], VX[l]); PC[l] += m[l] & 2);
+            break;
+        case 0x18:
+            LANES(ls->TIMER_SOUND[l] = BLEND(ls->TIMER_SOUND[l], VX[l]); PC[l] += m[l] & 2);
+            break;
+        case 0x1E:
+            LANES(ls->I[l] += (m[l] ? VX[l] : 0); PC[l] += m[l] & 2);
+            break;
+        default:
+            return 0;
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+
+#undef ALU
+#undef LANES
+#undef BLEND
+}
+
+// Runs one instruction on a single lane, the same way chip8_step does
+//  returns the CHIP8_STOP_* event the instruction raised, if any
+//  (cycles are counted by lockstep_run)
+static int step_lane(struct lockstep * ls, unsigned int lane, unsigned int stop_mask)
+{
+    uint8_t * ram = &ls->RAM[(size_t) lane * 4096];
+    uint64_t * screen = &ls->SCREEN[lane * 32];
+
+#define V(x) (ls->V[(x)][lane])
+#define PC (ls->PC[lane])
+#define I (ls->I[lane])
+#define SP (ls->SP[lane])
+
+#define FAIL(e) do { \
+        ls->err[lane] = e; \
+        return CHIP8_STOP_ERROR; \
+    } while (0)
+
+    if (PC < 0x200) {
+        FAIL(PC_UNDERFLOW);
+    } else if (PC >= 4095) {
+        FAIL(PC_OVERFLOW);
+    }
+
+    unsigned short op = fetch(ls, lane, PC);
+    unsigned char opB = (op & 0x0F00) >> 8;
+    unsigned char opC = (op & 0x00F0) >> 4;
+    unsigned char opD = (op & 0x000F);
+    unsigned char opL = (op & 0x00FF);
+    unsigned short opADDR = (op & 0x0FFF);
+
+    int event = 0;
+
+    switch ((op & 0xF000) >> 12) {
+    case 0:
+        if (opADDR == 0x0E0) {
+            PC += 2;
+            memset(screen, 0, 32 * sizeof(uint64_t));
+            ls->DIRTY[lane] = 0xFFFFFFFF;
+            event = CHIP8_STOP_DRAW;
+        } else if (opADDR == 0x0EE) {
+            PC += 2;
+            if (SP < 1) FAIL(STACK_UNDERFLOW);
+            SP --;
+            PC = ls->STACK[SP][lane];
+        } else {
+            FAIL(ILLEGAL_INSTRUCTION);
+        }
+        break;
+    case 1:
+        if (opADDR == PC) FAIL(INFINITE_LOOP);
+        PC = opADDR;
+        break;
+    case 2:
+        PC += 2;
+        if (SP > 15) FAIL(STACK_OVERFLOW);
+        ls->STACK[SP][lane] = PC;
+        SP ++;
+        PC = opADDR;
+        break;
+    case 3:
+        PC += (V(opB) == opL ? 4 : 2);
+        break;
+    case 4:
+        PC += (V(opB) != opL ? 4 : 2);
+        break;
+    case 5:
+        if (opD) FAIL(ILLEGAL_INSTRUCTION);
+        PC += (V(opB) == V(opC) ? 4 : 2);
+        break;
+    case 6:
+        PC += 2;
+        V(opB) = opL;
+        break;
+    case 7:
+        PC += 2;
+        V(opB) += opL;
+        break;
+    case 8: {
+        unsigned char x = V(opB), y = V(opC);
+        switch (opD) {
+        case 0: V(opB) = y; break;
+        case 1: V(opB) = x | y; V(0xF) = 0; break;
+        case 2: V(opB) = x & y; V(0xF) = 0; break;
+        case 3: V(opB) = x ^ y; V(0xF) = 0; break;
+        case 4: V(opB) = x + y; V(0xF) = (x + y > 255); break;
+        case 5: V(opB) = x - y; V(0xF) = (x >= y); break;
+        case 6: V(opB) = y >> 1; V(0xF) = y & 1; break;
+        case 7: V(opB) = y - x; V(0xF) = (y >= x); break;
+        case 0xE: V(opB) = y << 1; V(0xF) = y >> 7; break;
+        default: FAIL(ILLEGAL_INSTRUCTION);
+        }
+        PC += 2;
+        break;
+    }
+    case 9:
+        if (opD) FAIL(ILLEGAL_INSTRUCTION);
+        PC += (V(opB) != V(opC) ? 4 : 2);
+        break;
+    case 0xA:
+        PC += 2;
+        I = opADDR;
+        break;
+    case 0xB:
+        PC = opADDR + V(0);
+        break;
+    case 0xC:
+        PC += 2;
+        ls->RNG[lane] = next_rand(ls->RNG[lane]);
+        V(opB) = (ls->RNG[lane] >> 24) & opL;
+        break;
+    case 0xD: {
+        PC += 2;
+        unsigned char screenX = V(opB) % 64;
+        unsigned char screenY = V(opC) % 32;
+
+        unsigned char height = opD;
+        if (screenY + height > 32) height = 32 - screenY;
+
+        unsigned char collision = 0;
+        for (int y = 0; y < height; y ++) {
+            if (I + y > 4095) {
+                V(0xF) = collision;
+                FAIL(INDEX_OVERFLOW);
+            }
+            uint64_t sprite = ((uint64_t) ram[I + y] << 56) >> screenX;
+            uint64_t * row = &screen[screenY + y];
+
+            if (*row & sprite) collision = 1;
+            *row ^= sprite;
+            if (sprite) ls->DIRTY[lane] |= (uint32_t) 1 << (screenY + y);
+        }
+        V(0xF) = collision;
+        event = CHIP8_STOP_DRAW;
+        break;
+    }
+    case 0xE:
+        if (opL != 0x9E && opL != 0xA1) FAIL(ILLEGAL_INSTRUCTION);
+        PC += 2;
+        if (V(opB) > 15) FAIL(BAD_KEY);
+        if (((ls->KEYS[lane] >> V(opB)) & 1) == (opL == 0x9E))
+            PC += 2;
+        break;
+    case 0xF:
+        switch (opL) {
+        case 0x07:
+            PC += 2;
+            V(opB) = ls->TIMER_DELAY[lane];
+            break;
+        case 0x0A:
+            if (! ls->await_key) {
+                // the lane waits on its own keypad, as a machine does: it
+                //  sits out every run until lockstep_set_key finishes the
+                //  instruction
+                ls->AWAIT[lane] = 0x10 | opB;
+                ls->AWAIT_DOWN[lane] = 0;
+                event = CHIP8_STOP_WAIT;
+                break;
+            }
+            PC += 2;
+            V(opB) = ls->await_key(ls->ctx, lane);
+            // await_key usually expects to take some time
+            ls->TIMER_DELAY[lane] = 0;
+            ls->TIMER_SOUND[lane] = 0;
+            event = CHIP8_STOP_KEY;
+            break;
+        case 0x15:
+            PC += 2;
+            ls->TIMER_DELAY[lane] = V(opB);
+            break;
+        case 0x18:
+            PC += 2;
+            ls->TIMER_SOUND[lane] = V(opB);
+            break;
+        case 0x1E:
+            PC += 2;
+            I += V(opB);
+            break;
+        case 0x29:
+            PC += 2;
+            if (V(opB) > 15) FAIL(ILLEGAL_DIGIT);
+            I = V(opB) * 5;
+            break;
+        case 0x33: {
+            PC += 2;
+            if (I > 4093) FAIL(INDEX_OVERFLOW);
+            unsigned char value = V(opB);
+            ram[I + 2] = value % 10;
+            value /= 10;
+            ram[I + 1] = value % 10;
+            value /= 10;
+            ram[I] = value;
+            memset(&ls->TOUCHED[I], 1, 3);
+            break;
+        }
+        case 0x55:
+            PC += 2;
+            if (I + opB > 4095) FAIL(INDEX_OVERFLOW);
+            memset(&ls->TOUCHED[I], 1, opB + 1);
+            for (int i = 0; i <= opB; i ++) {
+                ram[I] = V(i);
+                I ++;
+            }
+            break;
+        case 0x65:
+            PC += 2;
+            if (I + opB > 4095) FAIL(INDEX_OVERFLOW);
+            for (int i = 0; i <= opB; i ++) {
+                V(i) = ram[I];
+                I ++;
+            }
+            break;
+        default:
+            FAIL(ILLEGAL_INSTRUCTION);
+        }
+        break;
+    }
+
+    return event & stop_mask;
+
+#undef FAIL
+#undef SP
+#undef I
+#undef PC
+#undef V
+}
+
+// first lane at or after lane with its mask set, or count if none
+//  masks are mostly clear by the end of a step, so look 8 lanes at a time
+static unsigned int next_lane(const uint8_t * mask, unsigned int lane, unsigned int count)
+{
+    while (lane < count && (lane & 7)) {
+        if (mask[lane]) return lane;
+        lane ++;
+    }
+    for (; lane < count; lane += 8) {
+        uint64_t word;
+        memcpy(&word, &mask[lane], sizeof(word));
+        if (word) {
+            lane += __builtin_ctzll(word) / 8;
+            break;
+        }
+    }
+    return (lane < count ? lane : count);
+}
+
+// Runs every lane for up to max_cycles steps
+//  each step, lanes are gathered into groups sitting on the same opcode at
+//  the same address, and each group runs one instruction together
+//  every running lane runs exactly one instruction per step, so cycles are
+//  only counted when a lane stops, and for the survivors at the end
+unsigned int lockstep_run(struct lockstep * ls, unsigned int max_cycles, unsigned int stop_mask)
+{
+    const unsigned int lanes = ls->lanes;
+    const unsigned int count = ls->count;
+    uint8_t * run = ls->run;
+    uint8_t * todo = ls->todo;
+    uint8_t * group = ls->group;
+
+    unsigned int running = 0;
+    for (unsigned int l = 0; l < lanes; l ++) {
+        run[l] = (l < count && ! ls->err[l] && ! ls->AWAIT[l] ? 0xFF : 0);
+        running += run[l] & 1;
+    }
+
+    // steps one lane by itself, retiring it if it stopped
+    //  an error or a wait means the instruction did not complete, and is not
+    //  counted
+#define STEP_LANE(l) do { \
+        todo[l] = 0; \
+        int event = step_lane(ls, l, stop_mask | CHIP8_STOP_ERROR | CHIP8_STOP_WAIT); \
+        if (event) { \
+            ls->cycles[l] += step + ! (event & (CHIP8_STOP_ERROR | CHIP8_STOP_WAIT)); \
+            run[l] = 0; \
+            running --; \
+        } \
+    } while (0)
+
+    unsigned int step;
+    for (step = 0; step < max_cycles && running; step ++) {
+        memcpy(todo, run, lanes);
+
+        unsigned int misses = 0;
+        for (unsigned int lane = next_lane(todo, 0, count); lane < count; lane = next_lane(todo, lane + 1, count)) {
+            unsigned short pc = ls->PC[lane];
+            if (misses >= MISS_LIMIT || pc < 0x200 || pc >= 4095) {
+                STEP_LANE(lane);
+                continue;
+            }
+
+            // gather every lane waiting at this pc with the same opcode
+            unsigned short op = fetch(ls, lane, pc);
+            const uint16_t * PC = ls->PC;
+            unsigned int size = 0;
+            for (unsigned int l = 0; l < lanes; l ++) {
+                group[l] = todo[l] & -(uint8_t) (PC[l] == pc);
+                size += group[l] & 1;
+            }
+            if (ls->TOUCHED[pc] || ls->TOUCHED[pc + 1]) {
+                for (unsigned int l = lane; l < count; l ++) {
+                    if (group[l] && fetch(ls, l, pc) != op) {
+                        group[l] = 0;
+                        size --;
+                    }
+                }
+            }
+
+            if (size > 1 && size * VECTOR_RATIO >= lanes && step_group(ls, pc, op, group)) {
+                for (unsigned int l = 0; l < lanes; l ++)
+                    todo[l] &= ~group[l];
+                continue;
+            }
+            misses += (size * VECTOR_RATIO < lanes);
+
+            // no good as a group: step each of them on their own
+            for (unsigned int l = lane; l < count; l = next_lane(group, l + 1, count))
+                STEP_LANE(l);
+        }
+    }
+
+#undef STEP_LANE
+
+    unsigned int alive = 0;
+    for (unsigned int l = 0; l < count; l ++) {
+        if (run[l]) ls->cycles[l] += step;
+        alive += ! ls->err[l];
+    }
+    return alive;
+}
+
+// Runs the built-in timers of every lane for one frame
+void lockstep_tick(struct lockstep * ls)
+{
+    for (unsigned int l = 0; l < ls->lanes; l ++) {
+        ls->TIMER_DELAY[l] -= (ls->TIMER_DELAY[l] != 0);
+        ls->TIMER_SOUND[l] -= (ls->TIMER_SOUND[l] != 0);
+    }
+}
+
+void lockstep_set_key(struct lockstep * ls, unsigned int lane, unsigned char key, unsigned char down)
+{
+    uint16_t bit = 1 << (key & 0xF);
+    // while FX0A waits, a key pressed and then let go ends it
+    if (ls->AWAIT[lane]) {
+        if (down && ! (ls->KEYS[lane] & bit)) {
+            ls->AWAIT_DOWN[lane] |= bit;
+        } else if (! down && (ls->AWAIT_DOWN[lane] & bit)) {
+            ls->V[ls->AWAIT[lane] & 0xF][lane] = key & 0xF;
+            ls->PC[lane] += 2;
+            ls->cycles[lane] ++;
+            ls->AWAIT[lane] = 0;
+        }
+    }
+    if (down)
+        ls->KEYS[lane] |= bit;
+    else
+        ls->KEYS[lane] &= ~bit;
+}
+
+uint32_t lockstep_present(struct lockstep * ls, unsigned int lane, const uint64_t ** screen)
+{
+    uint32_t dirty = ls->DIRTY[lane];
+    ls->DIRTY[lane] = 0;
+    *screen = &ls->SCREEN[lane * 32];
+    return dirty;
+}
+
+unsigned long lockstep_cycles(const struct lockstep * ls, unsigned int lane)
+{
+    return ls->cycles[lane];
+}
+
+int lockstep_error(const struct lockstep * ls, unsigned int lane)
+{
+    return ls->err[lane];
+}
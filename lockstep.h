@@ -0,0 +1,55 @@
+#ifndef LOCKSTEP_H_
+#define LOCKSTEP_H_
+
+#include <stdint.h>
+
+// Lockstep engine: many CHIP-8 machines running the same ROM side by side
+//  machines (lanes) are stored struct-of-arrays, so when a group of lanes
+//  sits on the same instruction it runs across all of them at once, in
+//  loops the compiler turns into SSE / AVX2 code
+//  lanes that wander off on their own are stepped one at a time
+//
+// Lanes behave like a chip8_create(NULL, NULL) machine with the built-in
+//  timers and keypad, plus an optional await_key callback for FX0A:
+//  without one, a lane in FX0A waits (and sits out lockstep_run) until a key
+//  is pressed and let go through lockstep_set_key, as chip8_set_key does
+//  CHIP8_STOP_* and error codes are the same as for interp.h
+struct lockstep;
+
+// Create lanes machines
+//  await_key may be NULL: FX0A then waits on the lane's keypad
+struct lockstep * lockstep_create(unsigned int lanes,
+                                  unsigned char (*await_key)(void * ctx, unsigned int lane),
+                                  void * ctx);
+
+// load the same chip8 program into every lane
+//  returns 0 if OK or 1 if the program does not fit
+int lockstep_load(struct lockstep * ls, const unsigned char * rom, unsigned short size);
+
+// Seeds the CXNN random number generator of one lane
+void lockstep_seed(struct lockstep * ls, unsigned int lane, uint32_t seed);
+
+// Runs every lane for up to max_cycles steps, each lane stopping early
+//  after any event in stop_mask (lanes with an error stay stopped)
+//  returns the number of lanes that have not hit an error
+unsigned int lockstep_run(struct lockstep * ls, unsigned int max_cycles, unsigned int stop_mask);
+
+// Runs the built-in timers of every lane for one frame
+void lockstep_tick(struct lockstep * ls);
+
+// Presses (down = 1) or releases (down = 0) a key of one lane
+void lockstep_set_key(struct lockstep * ls, unsigned int lane, unsigned char key, unsigned char down);
+
+// Same as chip8_present, for one lane
+uint32_t lockstep_present(struct lockstep * ls, unsigned int lane, const uint64_t ** screen);
+
+// Number of steps a lane has run
+unsigned long lockstep_cycles(const struct lockstep * ls, unsigned int lane);
+
+// The error a lane stopped with, or 0 if none
+int lockstep_error(const struct lockstep * ls, unsigned int lane);
+
+// Frees all lanes
+void lockstep_destroy(struct lockstep * ls);
+
+#endif
@@ -39,23 +39,24 @@ for ( my $i = 0 ; $i < scalar @rom ; $i++ ) {
 # dump C
 print <<EOF;
 #include <stdint.h>
-#include <setjmp.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "wrapper.h"
 
 // machine guts
-static uint8_t SCREEN[32][64] = {};
+static uint64_t SCREEN[32] = {};
+static uint32_t DIRTY = 0;
 static uint16_t I = 0;
 static uint8_t V[0x10] = {};
 
 #define STACK_DEPTH 16
-static jmp_buf STACK[STACK_DEPTH] = {};
+// return addresses, as labels (computed goto)
+static void * STACK[STACK_DEPTH] = {};
 static uint8_t SP = 0;
 
-uint8_t TIMER_DELAY = 0;
-uint8_t TIMER_SOUND = 0;
+// CXNN generator: xorshift32, as in the interpreter
+uint32_t RNG = 1;
 
 // RAM contents
 static uint8_t RAM[4096] = {
@@ -67,6 +68,13 @@ print <<EOF;
 };
 
 // helper functions
+static uint8_t rnd() {
+  RNG ^= RNG << 13;
+  RNG ^= RNG >> 17;
+  RNG ^= RNG << 5;
+  return RNG >> 24;
+}
+
 static const uint8_t plot(uint8_t x, uint8_t y, uint8_t height) {
   uint8_t collision = 0;
 
@@ -75,30 +83,28 @@ static const uint8_t plot(uint8_t x, uint8_t y, uint8_t height) {
 
   if (y + height > 32) height = 32 - y;
   for (uint8_t row = 0; row < height; row ++) {
-    uint8_t width = 8;
-    if (x + width > 64) width = 64 - x;
-    for (uint8_t col = 0; col < width; col ++) {
-      if (RAM[I + row] & (0x80 >> col)) {
-        uint8_t p = ! SCREEN[y + row][x + col];
-        SCREEN[y + row][x + col] = p;
-        screen_set(x + col, y + row, p);
-        if ( ! p) collision = 1;
-      }
-    }
+    // sprite bits past the right edge are shifted out
+    uint64_t sprite = ((uint64_t) RAM[I + row] << 56) >> x;
+    if (SCREEN[y + row] & sprite) collision = 1;
+    SCREEN[y + row] ^= sprite;
+    if (sprite) DIRTY |= (uint32_t) 1 << (y + row);
   }
 
-  screen_update();
+  screen_update(SCREEN, DIRTY);
+  DIRTY = 0;
 
   return collision;
 }
 
+// the cleared screen is shown like a sprite, rather than with the next one
 static void clear() {
-  memset(SCREEN, 0, 64 * 32);
-  screen_clear();
+  memset(SCREEN, 0, sizeof(SCREEN));
+  screen_update(SCREEN, 0xFFFFFFFF);
+  DIRTY = 0;
 }
 
 void run() {
-  clear();
+  DIRTY = 0xFFFFFFFF;
 EOF
 
 for ( my $j = 0 ; $j < 2 ; $j++ ) {
@@ -128,7 +134,7 @@ for ( my $j = 0 ; $j < 2 ; $j++ ) {
       } elsif ( $opADDR == 0xEE ) {
 
         # RET - return the machine state
-        print "longjmp(STACK[SP - 1], SP);";
+        print "goto *STACK[-- SP];";
       } else {
         printf "return;\t// ILLEGAL OPCODE (0x%04x)", $op;
       }
@@ -146,7 +152,7 @@ for ( my $j = 0 ; $j < 2 ; $j++ ) {
       if ( $opADDR < 0x200 || $opADDR > 0xFFE ) {
         printf "return;\t// ILLEGAL OPCODE (0x%04x)", $op;
       } else {
-        printf "if (setjmp(STACK[SP])) SP --; else { SP ++; goto lbl_%03x; }", $opADDR;
+        printf "STACK[SP ++] = &&ret_%03x; goto lbl_%03x;\nret_%03x:", $i, $opADDR, $i;
       }
     } elsif ( $opA == 3 ) {
       printf "if (V[0x%x] == 0x%02x) goto lbl_%03x;", $opB, $opL, $i + 4;
@@ -207,7 +213,7 @@ for ( my $j = 0 ; $j < 2 ; $j++ ) {
       }
       print "\t}";
     } elsif ( $opA == 0xC ) {
-      printf "V[0x%x] = rand() & 0x%02x;", $opB, $opL;
+      printf "V[0x%x] = rnd() & 0x%02x;", $opB, $opL;
     } elsif ( $opA == 0xD ) {
 
       # draw sprite
@@ -222,13 +228,13 @@ for ( my $j = 0 ; $j < 2 ; $j++ ) {
       }
     } elsif ( $opA == 0xF ) {
       if ( $opL == 0x07 ) {
-        printf "V[0x%x] = TIMER_DELAY;", $opB;
+        printf "V[0x%x] = get_timer_delay();", $opB;
       } elsif ( $opL == 0x0A ) {
         printf "V[0x%x] = await_key();", $opB;
       } elsif ( $opL == 0x15 ) {
-        printf "TIMER_DELAY = V[0x%x];", $opB;
+        printf "set_timer_delay(V[0x%x]);", $opB;
       } elsif ( $opL == 0x18 ) {
-        printf "TIMER_SOUND = V[0x%x];", $opB;
+        printf "set_timer_sound(V[0x%x]);", $opB;
       } elsif ( $opL == 0x1E ) {
         printf "I += V[0x%x];", $opB;
       } elsif ( $opL == 0x29 ) {
@@ -4,6 +4,8 @@ use warnings;
 use autodie;
 
 use List::Util qw(max any);
+use Getopt::Std;
+use Time::HiRes qw(time);
 
 ##### DEBUG
 use constant DEBUG => 0;
@@ -69,10 +71,10 @@ sub _d {
 ##### BITVECTOR OPERATIONS
 # Turn a vector into a list of elements
 sub vec2list {
+  my $bits = unpack( 'b*', $_[0] );
   my @ret;
-  for ( my $i = 0 ; $i < length( $_[0] ) * 8 ; $i++ ) {
-    push @ret, $i if vec( $_[0], $i, 1 );
-  }
+  my $i = -1;
+  push @ret, $i while ( $i = index( $bits, '1', $i + 1 ) ) >= 0;
   return @ret;
 }
 
@@ -105,8 +107,13 @@ sub load_rom {
   }
 }
 
+# -i: hybrid output, falling back to the interpreter where analysis fails
+# -t: report how long each phase took
+my %opts;
+getopts( 'it', \%opts );
+
 if ( scalar @ARGV == 0 ) {
-  print "Usage: $0 <file>.ch8\n";
+  print "Usage: $0 [-i] [-t] <file>.ch8\n";
   exit 0;
 }
 
@@ -115,609 +122,948 @@ my @ram;
 # Read input file
 load_rom( \@ram, $ARGV[0] );
 
-sub iterate {
-  my $pc          = shift;
-  my $i           = shift;
-  my $timer_delay = shift;
-  my @v           = @{ +shift };
-  my @stack       = @_;
+# the font the interpreter puts at the bottom of RAM
+my @font = (
+  0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20, 0x20, 0x70, 0xF0, 0x10, 0xF0, 0x80, 0xF0, 0xF0,
+  0x10, 0xF0, 0x10, 0xF0, 0x90, 0x90, 0xF0, 0x10, 0x10, 0xF0, 0x80, 0xF0, 0x10, 0xF0, 0xF0, 0x80,
+  0xF0, 0x90, 0xF0, 0xF0, 0x10, 0x20, 0x40, 0x40, 0xF0, 0x90, 0xF0, 0x90, 0xF0, 0xF0, 0x90, 0xF0,
+  0x10, 0xF0, 0xF0, 0x90, 0xF0, 0x90, 0x90, 0xE0, 0x90, 0xE0, 0x90, 0xE0, 0xF0, 0x80, 0x80, 0x80,
+  0xF0, 0xE0, 0x90, 0x90, 0x90, 0xE0, 0xF0, 0x80, 0xF0, 0x80, 0xF0, 0xF0, 0x80, 0xF0, 0x80, 0x80
+);
+
+# a byte of RAM, holding at least what it starts out as: the font, the
+#  ROM, or zero
+sub ram_cell {
+  my $addr = shift;
+  $ram[$addr]{ram} //= list2vec( $addr < @font ? $font[$addr] : 0 );
+  return $ram[$addr];
+}
 
-  while (1) {
-    if    ( $pc < 0x200 ) { die "PC underflow" }
-    elsif ( $pc > 4094 )  { die "PC overflow" }
+# where the analysis could not follow the program, and why
+#  without -i that ends the recompile, with it the interpreter runs from there
+my %fallback;
+
+# the contexts it gave up in, and the calls the interpreter may return from
+#  there
+my %gave_up;
+my %resume;
+
+sub give_up {
+  my ( $pc, $why, $ctx ) = @_;
+  die "$why\n" unless $opts{i};
+  $fallback{$pc} //= $why;
+  $gave_up{$ctx} = 1;
+}
+
+##### ANALYSIS
+# A fixed point over nodes: an instruction in a call context, the innermost
+#  CONTEXT_DEPTH calls it runs under as a string of 3-digit addresses, '' at
+#  the top level.  Each node holds the machine state that may reach it, the
+#  join of everything that arrived; a node whose state grows goes back on
+#  the worklist, and registers that grow too often are widened, so that
+#  happens a bounded number of times.  Deeper calls (recursion) share the
+#  truncated context, and a return goes to every caller seen for it.
+use constant CONTEXT_DEPTH => 4;
+
+# how often a register may grow at a node before it is taken as unknown
+use constant WIDEN_AFTER => 8;
+
+my @worklist;
+my %queued;
+
+# the contexts each call context was entered from, and the returns seen in it
+my %callers;
+my %returns;
+
+# nodes analysed, for the timing report
+my $nodes = 0;
+
+# the context inside a call made at $pc
+sub call {
+  my ( $ctx, $pc ) = @_;
+  my $inner = substr( $ctx . sprintf( '%03x', $pc ), -3 * CONTEXT_DEPTH );
+
+  # a new caller: the returns already analysed go to it too
+  if ( !$callers{$inner}{$ctx}++ ) {
+    push_node( $_, $inner ) foreach keys %{ $returns{$inner} };
+  }
+  return $inner;
+}
+
+sub push_node {
+  my ( $pc, $ctx ) = @_;
+  push @worklist, [ $pc, $ctx ] unless $queued{"$pc $ctx"}++;
+}
+
+# a state arrives at an instruction: join it into the node's
+sub reach {
+  my ( $pc, $ctx, $i, $timer_delay, $v ) = @_;
+  my @v = @$v;
+
+  if    ( $pc < 0x200 ) { return give_up( $pc, "PC underflow", $ctx ) }
+  elsif ( $pc > 4094 )  { return give_up( $pc, "PC overflow", $ctx ) }
+
+  # check for exec of uninitialized ram
+  if ( !( defined $ram[$pc] && defined $ram[$pc]{rom} ) ) {
+    return give_up( $pc, "Location $pc is uninitialized: runaway PC?", $ctx );
+  } elsif ( !( defined $ram[ $pc + 1 ] && defined $ram[ $pc + 1 ]{rom} ) ) {
+    return give_up( $pc, "Location $pc + 1 is uninitialized: runaway PC?", $ctx );
+  }
 
-    # check for exec of uninitialized ram
-    if ( !( defined $ram[$pc] && defined $ram[$pc]{rom} ) ) {
-      die "Location $pc is uninitialized: runaway PC?";
-    } elsif ( !( defined $ram[ $pc + 1 ] && defined $ram[ $pc + 1 ]{rom} ) ) {
-      die "Location $pc + 1 is uninitialized: runaway PC?";
+  # check for exec of a write area
+  #  TODO: technically, this is legal, if they write only the same byte
+  if ( $ram[$pc]{write} ) {
+    return give_up( $pc, "Location $pc already marked as Written Data but also executed: self-modifying code?", $ctx );
+  } elsif ( $ram[ $pc + 1 ]{write} ) {
+    return give_up( $pc, "Location $pc + 1 already marked as Written Data but also executed: self-modifying code?", $ctx );
+  }
+
+  my @grown = (0) x 16;
+
+  # unknown registers may hold anything, and so may ones no value reached:
+  #  an empty set would fold to nothing and settle every skip on it
+  $i = vecnorm( $i // '' ) ne '' ? vecnorm($i) : vecnorm( chr(255) x 512 );
+  $_ = vecnorm( $_ // '' ) ne '' ? vecnorm($_) : vecnorm( chr(255) x 32 ) foreach @v;
+
+  if ( $ram[$pc]{exec} ) {
+
+    # a check for alignment problems
+    if ( $ram[$pc]{exec}{nibble} == 2 ) {
+      return give_up( $pc, "Location $pc already marked as Low Instruction nibble: alignment issue?", $ctx );
     }
 
-    # check for exec of a write area
-    #  TODO: technically, this is legal, if they write only the same byte
-    if ( $ram[$pc]{write} ) {
-      die "Location $pc already marked as Written Data but also executed: self-modifying code?";
-    } elsif ( $ram[ $pc + 1 ]{write} ) {
-      die "Location $pc + 1 already marked as Written Data but also executed: self-modifying code?";
+    if ( !$ram[ $pc + 1 ]{exec}{nibble} ) {
+      return give_up( $pc, "Location $pc already marked as Instruction but $pc + 1 not: analyser bug?", $ctx );
+    } elsif ( $ram[ $pc + 1 ]{exec}{nibble} == 1 ) {
+      return give_up( $pc, "Location $pc + 1 already marked as High Instruction nibble: alignment issue?", $ctx );
     }
 
-    # block has Code path, check its ranges and return if fully covered
-    my $stack_str = join( '', map { sprintf( '%03x', $_ ) } @stack );
-    if ( $ram[$pc]{exec} ) {
+    my $old = $ram[$pc]{exec}{$ctx};
+    if ($old) {
 
-      # a check for alignment problems
-      if ( $ram[$pc]{exec}{nibble} == 2 ) {
-        die "Location $pc already marked as Low Instruction nibble: alignment issue?";
+      # join with what the node has: done if nothing grows
+      $i = vecnorm( $i | $old->{i} );
+      $v[$_] = vecnorm( $v[$_] | $old->{v}[$_] ) for ( 0 .. 15 );
+      $timer_delay = max( $timer_delay, $old->{timer_delay} );
+
+      # a register that keeps growing (a counter going round a loop) would
+      #  take a trip per value: give it every value at once instead
+      @grown = @{ $old->{grown} };
+      for my $j ( 0 .. 15 ) {
+        next if $v[$j] eq $old->{v}[$j];
+        $v[$j] = vecnorm( chr(255) x 32 ) if ++$grown[$j] > WIDEN_AFTER;
       }
 
-      if ( !$ram[ $pc + 1 ]{exec}{nibble} ) {
-        die "Location $pc already marked as Instruction but $pc + 1 not: analyser bug?";
-      } elsif ( $ram[ $pc + 1 ]{exec}{nibble} == 1 ) {
-        die "Location $pc + 1 already marked as High Instruction nibble: alignment issue?";
+      my $same = $i eq $old->{i} && $timer_delay == $old->{timer_delay};
+      for ( my $j = 0 ; $same && $j < 16 ; $j++ ) {
+        $same = $v[$j] eq $old->{v}[$j];
+      }
+      if ($same) {
+        print "CODE PATH TERMINATED AT PC=" . sprintf( "%03x", $pc ) . "\n" if DEBUG;
+        return;
       }
+    }
+  } else {
+
+    # previously unvisited area
+    if ( $ram[ $pc + 1 ]{exec} ) {
+      return give_up( $pc, "Location $pc + 1 already visited: alignment issue?", $ctx );
+    }
+  }
 
-      if ( $ram[$pc]{exec}{$stack_str} ) {
+  # mark code location on the map
+  $ram[$pc]{exec}{nibble}       = 1;
+  $ram[$pc]{exec}{$ctx}         = { i => $i, v => \@v, timer_delay => $timer_delay, grown => \@grown };
+  $ram[ $pc + 1 ]{exec}{nibble} = 2;
 
-        # check if we can Ret from this or more passes needed
-        my $t_i = defined $i ? vecnorm($i) : chr(255) x 512;
-        my $ret = vecnorm( $t_i & $ram[$pc]{exec}{$stack_str}{i} ) eq $t_i;
+  push_node( $pc, $ctx );
+}
 
-        for ( my $j = 0 ; $ret && $j < 16 ; $j++ ) {
-          my $t_v = defined $v[$j] ? vecnorm( $v[$j] ) : chr(255) x 32;
-          $ret = vecnorm( $t_v & $ram[$pc]{exec}{$stack_str}{v}[$j] ) eq $t_v;
-        }
-        if ($ret) {
-          $ret = ( $timer_delay <= $ram[$pc]{exec}{$stack_str}{timer_delay} );
-        }
-        if ($ret) {
+# analyse one node: send its state on to where the instruction goes
+sub transfer {
+  my ( $pc, $ctx ) = @_;
+  my $state       = $ram[$pc]{exec}{$ctx};
+  my $i           = $state->{i};
+  my $timer_delay = $state->{timer_delay};
+  my @v           = @{ $state->{v} };
+  $nodes++;
 
-          # all checks passed: the machine state here has already been examined further
-          print "CODE PATH TERMINATED AT PC=" . sprintf( "%03x", $pc ) . "\n" if DEBUG;
-          return;
-        }
+  # retrieve opcode
+  my $op = ( $ram[$pc]{rom} << 8 ) | $ram[ $pc + 1 ]{rom};
 
-        # bummer, have to parse this further.  grow each value to cover both new and existing cases
-        $i = vecnorm( $i | $ram[$pc]{exec}{$stack_str}{i} ) if ( defined $i );
-        for my $j ( 0 .. 15 ) {
-          $v[$j] = vecnorm( $v[$j] | $ram[$pc]{exec}{$stack_str}{v}[$j] ) if ( defined $v[$j] );
-        }
-        $timer_delay = max( $timer_delay, $ram[$pc]{exec}{$stack_str}{timer_delay} );
-      }
-    } else {
+  # helpers to parse an instruction
+  my $opA = ( ( $op & 0xF000 ) >> 12 );
+  my $opB = ( ( $op & 0x0F00 ) >> 8 );
+  my $opC = ( ( $op & 0x00F0 ) >> 4 );
+  my $opD = ( $op & 0x000F );
+
+  my $opL = ( $op & 0x00FF );
+
+  my $opADDR = ( $op & 0x0FFF );
 
-      # previously unvisited area
-      if ( $ram[ $pc + 1 ]{exec} ) {
-        die "Location $pc + 1 already visited: alignment issue?";
+  if ( $opA == 0 ) {
+
+    # call machine routine
+    if ( $opADDR == 0x0E0 ) {
+
+      # screen clear - affects nothing
+      _d( "Screen clear", $pc, $op, $i, $timer_delay, @v );
+
+    } elsif ( $opADDR == 0xEE ) {
+
+      # RET - return the machine state, to every caller of this context
+      _d( "RET from sub", $pc, $op, $i, $timer_delay, @v );
+      if ( $ctx eq '' ) {
+        return give_up( $pc, "Return from empty stack at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ), $ctx );
       }
+      $returns{$ctx}{$pc} = 1;
+      my $call = hex substr( $ctx, -3 );
+      reach( $call + 2, $_, $i, $timer_delay, \@v ) foreach sort keys %{ $callers{$ctx} };
+      return;
+    } else {
+      return give_up( $pc, "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ), $ctx );
     }
+    $pc += 2;
+  } elsif ( $opA == 1 ) {
 
-    # mark code location on the map
-    $ram[$pc]{exec}{nibble}                  = 1;
-    $ram[$pc]{exec}{$stack_str}{i}           = defined $i ? $i : chr(255) x 512;
-    $ram[$pc]{exec}{$stack_str}{v}[$_]       = defined $v[$_] ? $v[$_] : chr(255) x 32 for ( 0 .. 15 );
-    $ram[$pc]{exec}{$stack_str}{timer_delay} = $timer_delay;
-    $ram[ $pc + 1 ]{exec}{nibble}            = 2;
+    # Jump statement
+    _d( "JUMP to " . sprintf( "%03x", $opADDR ), $pc, $op, $i, $timer_delay, @v );
+    $pc = $opADDR;
+  } elsif ( $opA == 2 ) {
 
-    # retrieve opcode
-    my $op = ( $ram[$pc]{rom} << 8 ) | $ram[ $pc + 1 ]{rom};
+    # Call subroutine
+    _d( "CALL SUB at " . sprintf( "%03x", $opADDR ), $pc, $op, $i, $timer_delay, @v );
 
-    # helpers to parse an instruction
-    my $opA = ( ( $op & 0xF000 ) >> 12 );
-    my $opB = ( ( $op & 0x0F00 ) >> 8 );
-    my $opC = ( ( $op & 0x00F0 ) >> 4 );
-    my $opD = ( $op & 0x000F );
+    # Push our address onto the stack and move the PC
+    $ctx = call( $ctx, $pc );
 
-    my $opL = ( $op & 0x00FF );
+    $pc = $opADDR;
+  } elsif ( $opA == 3 || $opA == 4 ) {
 
-    my $opADDR = ( $op & 0x0FFF );
+    _d( "TEST " . ( $opA == 3 ? 'IN' : '' ) . "equality v[$opB] vs $opL", $pc, $op, $i, $timer_delay, @v );
 
-    if ( $opA == 0 ) {
+    # literal (in)equality test
+    if ( !defined $v[$opB] ) {
+      warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+      $v[$opB] = chr(255) x 32;
+    }
 
-      # call machine routine
-      if ( $opADDR == 0x0E0 ) {
+    my $equal    = vecnorm( $v[$opB] & list2vec($opL) );
+    my $nonequal = vecnorm( $v[$opB] ^ $equal );
 
-        # screen clear - affects nothing
-        _d( "Screen clear", $pc, $op, $i, $timer_delay, @v );
+    my $exec = ( $opA == 3 ? $nonequal : $equal );
+    my $skip = ( $opA == 3 ? $equal    : $nonequal );
 
-      } elsif ( $opADDR == 0xEE ) {
+    print "-> exec_vec = " . vec2range($exec) . ", skip_vec = " . vec2range($skip) . "\n" if DEBUG;
 
-        # RET - return the machine state
-        _d( "RET from sub", $pc, $op, $i, $timer_delay, @v );
-        if ( !@stack ) {
-          die "Return from empty stack at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-        }
-        $pc = pop @stack;
-      } else {
-        die "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-      }
-      $pc += 2;
-    } elsif ( $opA == 1 ) {
+    $pc += 2;
 
-      # Jump statement
-      _d( "JUMP to " . sprintf( "%03x", $opADDR ), $pc, $op, $i, $timer_delay, @v );
-      $pc = $opADDR;
-    } elsif ( $opA == 2 ) {
+    if ($exec) {
 
-      # Call subroutine
-      _d( "CALL SUB at " . sprintf( "%03x", $opADDR ), $pc, $op, $i, $timer_delay, @v );
+      # condition is possible to be False, no skipping
 
-      # Push our address onto the stack and move the PC
-      push @stack, $pc;
+      if ( !$skip ) {
 
-      $pc = $opADDR;
-    } elsif ( $opA == 3 || $opA == 4 ) {
+        # this is a special case where we can ignore the iterate call and just go
+        $v[$opB] = $exec;
 
-      _d( "TEST " . ( $opA == 3 ? 'IN' : '' ) . "equality v[$opB] vs $opL", $pc, $op, $i, $timer_delay, @v );
+      } else {
+
+        # set up a call into the instruction
+        my @new_v = @v;
+        $new_v[$opB] = $exec;
+        reach( $pc, $ctx, $i, $timer_delay, \@new_v );
+
+        # ready to proceed.  but first, update our V.
+
+        $v[$opB] = $skip;
+        $pc += 2;
+      }
+    } else {
+
+      # Condition never executed: simply bypass this instruction
+      $v[$opB] = $skip;
+      $pc += 2;
+    }
+  } elsif ( $opA == 5 || $opA == 9 ) {
+    if ( $opD == 0 ) {
 
-      # literal (in)equality test
       if ( !defined $v[$opB] ) {
         warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
         $v[$opB] = chr(255) x 32;
       }
 
-      my $equal    = vecnorm( $v[$opB] & list2vec($opL) );
-      my $nonequal = vecnorm( $v[$opB] ^ $equal );
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
 
-      my $exec = ( $opA == 3 ? $nonequal : $equal );
-      my $skip = ( $opA == 3 ? $equal    : $nonequal );
+      # the overlap of these two determines equality
+      my $equal = vecnorm( $v[$opB] & $v[$opC] );
 
-      print "-> exec_vec = " . vec2range($exec) . ", skip_vec = " . vec2range($skip) . "\n" if DEBUG;
+      # and they may differ unless both hold the same single value
+      my @listB  = vec2list( $v[$opB] );
+      my @listC  = vec2list( $v[$opC] );
+      my $differ = !( @listB == 1 && @listC == 1 && $listB[0] == $listC[0] );
 
       $pc += 2;
 
-      if ($exec) {
-
-        # condition is possible to be False, no skipping
+      # TODO this could be better with a concept of linked registers or unlinked
 
-        if ( !$skip ) {
+      if ( $opA == 5 ) {
 
-          # this is a special case where we can ignore the iterate call and just go
-          $v[$opB] = $exec;
-
-        } else {
+        _d( "TEST EQUALITY v[$opB] vs $opL\n + equal vec = " . vec2range($equal), $pc, $op, $i, $timer_delay, @v );
 
-          # set up a call into the instruction
-          my @new_v = @v;
-          $new_v[$opB] = $exec;
-          iterate( $pc, $i, $timer_delay, \@new_v, @stack );
+        # The two are sometimes unequal: iterate on that case
+        reach( $pc, $ctx, $i, $timer_delay, \@v ) if ( $equal && $differ );
 
-          # ready to proceed.  but first, update our V.
+        if ($equal) {
 
-          $v[$opB] = $skip;
+          # Continue on the "skipped" path where they are equal
+          $v[$opB] = $v[$opC] = $equal;
           $pc += 2;
         }
-      } else {
 
-        # Condition never executed: simply bypass this instruction
-        $v[$opB] = $skip;
-        $pc += 2;
-      }
-    } elsif ( $opA == 5 || $opA == 9 ) {
-      if ( $opD == 0 ) {
+        # never equal: never skips
 
-        if ( !defined $v[$opB] ) {
-          warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opB] = chr(255) x 32;
-        }
+      } else {
 
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
+        # the skipped instruction MAY be executed for the equality cases
+        _d( "TEST INEQUALITY v[$opB] vs $opL\n + equal vec = " . vec2range($equal), $pc, $op, $i, $timer_delay, @v );
+        if ( $equal && $differ ) {
+          my @new_v = @v;
+          $new_v[$opB] = $new_v[$opC] = $equal;
+          reach( $pc, $ctx, $i, $timer_delay, \@new_v );
         }
 
-        # the overlap of these two determines equality
-        my $equal = vecnorm( $v[$opB] & $v[$opC] );
+        # execute the NEQ branch, unless they are always equal
+        if ($differ) {
+          $pc += 2;
+        } else {
+          $v[$opB] = $v[$opC] = $equal;
+        }
+      }
+    } else {
+      return give_up( $pc, "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ), $ctx );
+    }
+  } elsif ( $opA == 6 ) {
 
-        $pc += 2;
+    _d( "SET v[$opB] to $opL", $pc, $op, $i, $timer_delay, @v );
 
-        # TODO this could be better with a concept of linked registers or unlinked
+    # Assign literal to register
+    $v[$opB] = list2vec($opL);
 
-        if ( $opA == 5 ) {
+    $pc += 2;
+  } elsif ( $opA == 7 ) {
+    _d( "ADD LIT v[$opB] to $opL", $pc, $op, $i, $timer_delay, @v );
 
-          _d( "TEST EQUALITY v[$opB] vs $opL\n + equal vec = " . vec2range($equal), $pc, $op, $i, $timer_delay, @v );
+    if ( !defined $v[$opB] ) {
+      warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+      $v[$opB] = chr(255) x 32;
+    }
 
-          if ($equal) {
+    # Add literal to register
+    $v[$opB] = list2vec( map { ( $_ + $opL ) % 256 } vec2list( $v[$opB] ) );
 
-            # The two are sometimes equal: iterate on the case where they are not
-            iterate( $pc, $i, $timer_delay, \@v, @stack );
+    $pc += 2;
+  } elsif ( $opA == 8 ) {
 
-            # Continue on the "skipped" path where they are
-            $v[$opB] = $v[$opC] = $equal;
-          }
+    # Register-register operations
+    if ( $opD == 0 ) {
 
-          $pc += 2;
+      _d( "SET v[$opB] to v[$opC]", $pc, $op, $i, $timer_delay, @v );
 
-        } else {
+      # Assign register to register
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
+      $v[$opB] = $v[$opC];
+    } elsif ( $opD == 1 ) {
 
-          # the skipped instruction MAY be executed for the equality cases
-          _d( "TEST INEQUALITY v[$opB] vs $opL\n + equal vec = " . vec2range($equal), $pc, $op, $i, $timer_delay, @v );
-          if ($equal) {
-            my @new_v = @v;
-            $new_v[$opB] = $new_v[$opC] = $equal;
-            iterate( $pc, $i, $timer_delay, \@new_v, @stack );
-          }
+      # OR operation
+      _d( "SET v[$opB] |= v[$opC]", $pc, $op, $i, $timer_delay, @v );
+      if ( !defined $v[$opB] ) {
+        warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opB] = chr(255) x 32;
+      }
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
 
-          # always execute the NEQ branch
+      my @result_set;
+      foreach my $c ( vec2list( $v[$opC] ) ) {
+        foreach my $b ( vec2list( $v[$opB] ) ) {
+          push @result_set, ( $b | $c );
         }
-      } else {
-        die "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
       }
+      $v[$opB] = list2vec(@result_set);
+      $v[0xF] = list2vec(0);
+    } elsif ( $opD == 2 ) {
 
-      $pc += 2;
-    } elsif ( $opA == 6 ) {
+      # AND operation
+      _d( "SET v[$opB] &= v[$opC]", $pc, $op, $i, $timer_delay, @v );
+      if ( !defined $v[$opB] ) {
+        warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opB] = chr(255) x 32;
+      }
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
+      my @result_set;
+      foreach my $c ( vec2list( $v[$opC] ) ) {
+        foreach my $b ( vec2list( $v[$opB] ) ) {
+          push @result_set, ( $b & $c );
+        }
+      }
+      $v[$opB] = list2vec(@result_set);
+      $v[0xF] = list2vec(0);
+    } elsif ( $opD == 3 ) {
 
-      _d( "SET v[$opB] to $opL", $pc, $op, $i, $timer_delay, @v );
+      _d( "SET v[$opB] ^= v[$opC]", $pc, $op, $i, $timer_delay, @v );
 
-      # Assign literal to register
-      $v[$opB] = list2vec($opL);
+      # XOR operation
+      if ( !defined $v[$opB] ) {
+        warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opB] = chr(255) x 32;
+      }
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
+      my @result_set;
+      foreach my $c ( vec2list( $v[$opC] ) ) {
+        foreach my $b ( vec2list( $v[$opB] ) ) {
+          push @result_set, ( $b ^ $c );
+        }
+      }
+      $v[$opB] = list2vec(@result_set);
+      $v[0xF] = list2vec(0);
+    } elsif ( $opD == 4 ) {
 
-      $pc += 2;
-    } elsif ( $opA == 7 ) {
-      _d( "ADD LIT v[$opB] to $opL", $pc, $op, $i, $timer_delay, @v );
+      _d( "SET v[$opB] += v[$opC]", $pc, $op, $i, $timer_delay, @v );
 
+      # ADD
       if ( !defined $v[$opB] ) {
         warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
         $v[$opB] = chr(255) x 32;
       }
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
 
-      # Add literal to register
-      $v[$opB] = list2vec( map { ( $_ + $opL ) % 256 } vec2list( $v[$opB] ) );
+      # this is chaotic but it basically makes a new list out of the combination of both registers
+      my @result_set;
+      foreach my $c ( vec2list( $v[$opC] ) ) {
+        foreach my $b ( vec2list( $v[$opB] ) ) {
+          push @result_set, ( $b + $c );
+        }
+      }
+      $v[$opB] = list2vec( map { $_ % 256 } @result_set );
+      $v[0xF] = list2vec( map { $_ > 255 } @result_set );
+    } elsif ( $opD == 5 ) {
 
-      $pc += 2;
-    } elsif ( $opA == 8 ) {
+      _d( "SET v[$opB] -= v[$opC]", $pc, $op, $i, $timer_delay, @v );
 
-      # Register-register operations
-      if ( $opD == 0 ) {
+      # SUBTRACT
+      if ( !defined $v[$opB] ) {
+        warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opB] = chr(255) x 32;
+      }
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
+      my @result_set;
+      foreach my $c ( vec2list( $v[$opC] ) ) {
+        foreach my $b ( vec2list( $v[$opB] ) ) {
+          push @result_set, ( $b - $c );
+        }
+      }
+      $v[$opB] = list2vec( map { ( $_ + 256 ) % 256 } @result_set );
+      $v[0xF] = list2vec( map { $_ >= 0 } @result_set );
 
-        _d( "SET v[$opB] to v[$opC]", $pc, $op, $i, $timer_delay, @v );
+    } elsif ( $opD == 6 ) {
 
-        # Assign register to register
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
-        }
-        $v[$opB] = $v[$opC];
-      } elsif ( $opD == 1 ) {
-
-        # OR operation
-        _d( "SET v[$opB] |= v[$opC]", $pc, $op, $i, $timer_delay, @v );
-        if ( !defined $v[$opB] ) {
-          warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opB] = chr(255) x 32;
-        }
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
-        }
+      _d( "SET v[$opB] = v[$opC] >> 1", $pc, $op, $i, $timer_delay, @v );
 
-        my @result_set;
-        foreach my $c ( vec2list( $v[$opC] ) ) {
-          foreach my $b ( vec2list( $v[$opB] ) ) {
-            push @result_set, ( $b | $c );
-          }
-        }
-        $v[$opB] = list2vec(@result_set);
-        $v[0xF] = list2vec(0);
-      } elsif ( $opD == 2 ) {
-
-        # AND operation
-        _d( "SET v[$opB] &= v[$opC]", $pc, $op, $i, $timer_delay, @v );
-        if ( !defined $v[$opB] ) {
-          warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opB] = chr(255) x 32;
-        }
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
-        }
-        my @result_set;
-        foreach my $c ( vec2list( $v[$opC] ) ) {
-          foreach my $b ( vec2list( $v[$opB] ) ) {
-            push @result_set, ( $b & $c );
-          }
-        }
-        $v[$opB] = list2vec(@result_set);
-        $v[0xF] = list2vec(0);
-      } elsif ( $opD == 3 ) {
+      # shift right
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
 
-        _d( "SET v[$opB] ^= v[$opC]", $pc, $op, $i, $timer_delay, @v );
+      my @listC = vec2list( $v[$opC] );
+      $v[$opB] = list2vec( map { $_ >> 1 } @listC );
+      $v[0xF] = list2vec( map { $_ & 1 } @listC );
+    } elsif ( $opD == 7 ) {
 
-        # XOR operation
-        if ( !defined $v[$opB] ) {
-          warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opB] = chr(255) x 32;
-        }
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
-        }
-        my @result_set;
-        foreach my $c ( vec2list( $v[$opC] ) ) {
-          foreach my $b ( vec2list( $v[$opB] ) ) {
-            push @result_set, ( $b ^ $c );
-          }
+      # other subtract
+      # SUBTRACT
+      _d( "SET v[$opB] = v[$opC] - b", $pc, $op, $i, $timer_delay, @v );
+      if ( !defined $v[$opB] ) {
+        warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opB] = chr(255) x 32;
+      }
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
+      my @result_set;
+      foreach my $c ( vec2list( $v[$opC] ) ) {
+        foreach my $b ( vec2list( $v[$opB] ) ) {
+          push @result_set, ( $c - $b );
         }
-        $v[$opB] = list2vec(@result_set);
-        $v[0xF] = list2vec(0);
-      } elsif ( $opD == 4 ) {
+      }
+      $v[$opB] = list2vec( map { ( $_ + 256 ) % 256 } @result_set );
+      $v[0xF] = list2vec( map { $_ >= 0 } @result_set );
+    } elsif ( $opD == 0xE ) {
+
+      # shift left
+      _d( "SET v[$opB] = v[$opC] << 1", $pc, $op, $i, $timer_delay, @v );
+      if ( !defined $v[$opC] ) {
+        warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opC] = chr(255) x 32;
+      }
+      my @listC = vec2list( $v[$opC] );
+      $v[$opB] = list2vec( map { ( $_ << 1 ) & 0xFF } @listC );
+      $v[0xF] = list2vec( map { ( $_ & 0x80 ) >> 7 } @listC );
+    } else {
+      return give_up( $pc, "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ), $ctx );
+    }
 
-        _d( "SET v[$opB] += v[$opC]", $pc, $op, $i, $timer_delay, @v );
+    $pc += 2;
+  } elsif ( $opA == 0xA ) {
 
-        # ADD
-        if ( !defined $v[$opB] ) {
-          warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opB] = chr(255) x 32;
-        }
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
-        }
+    # Set I to (addr)
+    _d( "SET I to " . sprintf( "%03x", $opADDR ), $pc, $op, $i, $timer_delay, @v );
+    if ( $opADDR < 0x200 ) {
+      warn "Program sets I to $opADDR at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+    }
+    $i = list2vec($opADDR);
+    $pc += 2;
+  } elsif ( $opA == 0xB ) {
 
-        # this is chaotic but it basically makes a new list out of the combination of both registers
-        my @result_set;
-        foreach my $c ( vec2list( $v[$opC] ) ) {
-          foreach my $b ( vec2list( $v[$opB] ) ) {
-            push @result_set, ( $b + $c );
-          }
-        }
-        $v[$opB] = list2vec( map { $_ % 256 } @result_set );
-        $v[0xF] = list2vec( map { $_ > 255 } @result_set );
-      } elsif ( $opD == 5 ) {
+    _d( "JUMP to " . sprintf( "%03x", $opADDR ) . " + v[0]", $pc, $op, $i, $timer_delay, @v );
 
-        _d( "SET v[$opB] -= v[$opC]", $pc, $op, $i, $timer_delay, @v );
+    # computed jump: follow every target v[0] may select, with v[0] pinned
+    #  to the value that selects it
+    if ( !defined $v[0] ) {
+      warn "Uninitialized register 0 at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+      $v[0] = chr(255) x 32;
+    }
 
-        # SUBTRACT
-        if ( !defined $v[$opB] ) {
-          warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opB] = chr(255) x 32;
-        }
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
-        }
-        my @result_set;
-        foreach my $c ( vec2list( $v[$opC] ) ) {
-          foreach my $b ( vec2list( $v[$opB] ) ) {
-            push @result_set, ( $b - $c );
-          }
-        }
-        $v[$opB] = list2vec( map { ( $_ + 256 ) % 256 } @result_set );
-        $v[0xF] = list2vec( map { $_ >= 0 } @result_set );
+    my @offsets = vec2list( $v[0] );
+    if ( !@offsets ) {
+      return give_up( $pc, "Jump with no possible target at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ), $ctx );
+    }
 
-      } elsif ( $opD == 6 ) {
+    my $last = pop @offsets;
+    foreach my $offset (@offsets) {
+      my @new_v = @v;
+      $new_v[0] = list2vec($offset);
+      reach( $opADDR + $offset, $ctx, $i, $timer_delay, \@new_v );
+    }
 
-        _d( "SET v[$opB] = v[$opC] >> 1", $pc, $op, $i, $timer_delay, @v );
+    # and continue on the last one
+    $v[0] = list2vec($last);
+    $pc = $opADDR + $last;
+  } elsif ( $opA == 0xC ) {
 
-        # shift right
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
-        }
+    _d( "SET v[$opB] to rand() & $opL", $pc, $op, $i, $timer_delay, @v );
 
-        my @listC = vec2list( $v[$opC] );
-        $v[$opB] = list2vec( map { $_ >> 1 } @listC );
-        $v[0xF] = list2vec( map { $_ & 1 } @listC );
-      } elsif ( $opD == 7 ) {
-
-        # other subtract
-        # SUBTRACT
-        _d( "SET v[$opB] = v[$opC] - b", $pc, $op, $i, $timer_delay, @v );
-        if ( !defined $v[$opB] ) {
-          warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opB] = chr(255) x 32;
-        }
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
-        }
-        my @result_set;
-        foreach my $c ( vec2list( $v[$opC] ) ) {
-          foreach my $b ( vec2list( $v[$opB] ) ) {
-            push @result_set, ( $c - $b );
-          }
-        }
-        $v[$opB] = list2vec( map { ( $_ + 256 ) % 256 } @result_set );
-        $v[0xF] = list2vec( map { $_ >= 0 } @result_set );
-      } elsif ( $opD == 0xE ) {
-
-        # shift left
-        _d( "SET v[$opB] = v[$opC] << 1", $pc, $op, $i, $timer_delay, @v );
-        if ( !defined $v[$opC] ) {
-          warn "Uninitialized register $opC at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opC] = chr(255) x 32;
+    # get rand & NNN
+    $v[$opB] = list2vec( map { $_ & $opL } ( 0 .. 255 ) );
+    $pc += 2;
+  } elsif ( $opA == 0xD ) {
+
+    _d( "PLOT $opD height at v[$opB], v[$opC]", $pc, $op, $i, $timer_delay, @v );
+    if ( $opD == 0 ) {
+      warn "Zero-height sprite at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+      $v[0xF] = list2vec(0);
+    } else {
+
+      # it's plot - this marks data for Read!
+      for ( my $j = 0 ; $j < $opD ; $j++ ) {
+        foreach my $offset ( vec2list($i) ) {
+          $ram[ $offset + $j ]{read} = 1;
         }
-        my @listC = vec2list( $v[$opC] );
-        $v[$opB] = list2vec( map { $_ << 1 } @listC );
-        $v[0xF] = list2vec( map { ( $_ & 0x80 ) >> 7 } @listC );
-      } else {
-        die "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
       }
+      $v[0xF] = list2vec( 0, 1 );
+    }
+    $pc += 2;
+  } elsif ( $opA == 0xE ) {
+    if ( $opL == 0x9E || $opL == 0xA1 ) {
 
-      $pc += 2;
-    } elsif ( $opA == 0xA ) {
+      _d( "CHECK KEY STATE v[$opB]", $pc, $op, $i, $timer_delay, @v );
 
-      # Set I to (addr)
-      _d( "SET I to " . sprintf( "%03x", $opADDR ), $pc, $op, $i, $timer_delay, @v );
-      if ( $opADDR < 0x200 ) {
-        warn "Program sets I to $opADDR at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-      }
-      $i = list2vec($opADDR);
+      # check key down or up
+      #  note that key check is & with 0xF
       $pc += 2;
-    } elsif ( $opA == 0xB ) {
-      die "BXXX";
 
-      # TODO TODO TODO
-      $pc = $opADDR + $v[0];
+      reach( $pc, $ctx, $i, $timer_delay, \@v );
       $pc += 2;
-    } elsif ( $opA == 0xC ) {
+    } else {
+      return give_up( $pc, "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ), $ctx );
+    }
+  } elsif ( $opA == 0xF ) {
+    if ( $opL == 0x07 ) {
 
-      _d( "SET v[$opB] to rand() & $opL", $pc, $op, $i, $timer_delay, @v );
+      _d( "GET DELAY INTO v[$opB]", $pc, $op, $i, $timer_delay, @v );
 
-      # get rand & NNN
-      $v[$opB] = list2vec( map { $_ & $opL } ( 0 .. 255 ) );
-      $pc += 2;
-    } elsif ( $opA == 0xD ) {
+      # get delay timer
+      $v[$opB] = list2vec( 0 .. $timer_delay );
+    } elsif ( $opL == 0x0A ) {
 
-      _d( "PLOT $opD height at v[$opB], v[$opC]", $pc, $op, $i, $timer_delay, @v );
-      if ( $opD == 0 ) {
-        warn "Zero-height sprite at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-        $v[0xF] = list2vec(0);
-      } else {
+      # wait key
+      _d( "AWAIT KEY INTO v[$opB]", $pc, $op, $i, $timer_delay, @v );
+      $v[$opB] = list2vec( 0 .. 15 );
+    } elsif ( $opL == 0x15 ) {
 
-        # it's plot - this marks data for Read!
-        for ( my $j = 0 ; $j < $opD ; $j++ ) {
-          foreach my $offset ( vec2list($i) ) {
-            $ram[ $offset + $j ]{read} = 1;
+      # delay may take any value between 0 and the highest it's ever been
+      $timer_delay = max( $timer_delay, vec2list( $v[$opB] ) );
+    } elsif ( $opL == 0x18 ) {
+
+      _d( "SET SOUND TIMER", $pc, $op, $i, $timer_delay, @v );
+
+      # set sound timer - does nothing
+    } elsif ( $opL == 0x1E ) {
+
+      _d( "ADVANCE I BY V[$opB]", $pc, $op, $i, $timer_delay, @v );
+
+      # advance I by v[opB]
+      my @result_set;
+      foreach my $j ( vec2list($i) ) {
+        foreach my $b ( vec2list( $v[$opB] ) ) {
+          if ( $j + $b < 4096 ) {
+            push @result_set, ( $j + $b );
+          } else {
+            warn "I + v[$opB] may exceed 4096 at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
           }
         }
-        $v[0xF] = list2vec( 0, 1 );
       }
-      $pc += 2;
-    } elsif ( $opA == 0xE ) {
-      if ( $opL == 0x9E || $opL == 0xA1 ) {
+      $i = list2vec(@result_set);
+    } elsif ( $opL == 0x29 ) {
 
-        _d( "CHECK KEY STATE v[$opB]", $pc, $op, $i, $timer_delay, @v );
+      _d( "HEX-DIGIT of v[$opB] to I", $pc, $op, $i, $timer_delay, @v );
 
-        # check key down or up
-        #  note that key check is & with 0xF
-        $pc += 2;
-
-        iterate( $pc, $i, $timer_delay, \@v, @stack );
-        $pc += 2;
-      } else {
-        die "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+      if ( !defined $v[$opB] ) {
+        warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
+        $v[$opB] = chr(255) x 32;
       }
-    } elsif ( $opA == 0xF ) {
-      if ( $opL == 0x07 ) {
-
-        _d( "GET DELAY INTO v[$opB]", $pc, $op, $i, $timer_delay, @v );
 
-        # get delay timer
-        $v[$opB] = list2vec( 0 .. $timer_delay );
-      } elsif ( $opL == 0x0A ) {
+      # assign I to a digit - any value 0 to 200 really
+      $i = list2vec( 0 .. 199 );
+    } elsif ( $opL == 0x33 ) {
 
-        # wait key
-        _d( "AWAIT KEY INTO v[$opB]", $pc, $op, $i, $timer_delay, @v );
-        $v[$opB] = list2vec( 0 .. 15 );
-      } elsif ( $opL == 0x15 ) {
+      # BCD dump
+      #if ( $i > 4093 ) {
+      #die "I overflow";
+      #}
 
-        # delay may take any value between 0 and the highest it's ever been
-        $timer_delay = max( $timer_delay, vec2list($opB) );
-      } elsif ( $opL == 0x18 ) {
+      _d( "BCD of v[$opB] to I", $pc, $op, $i, $timer_delay, @v );
 
-        _d( "SET SOUND TIMER", $pc, $op, $i, $timer_delay, @v );
+      foreach my $off ( vec2list($i) ) {
+        if ( $ram[$off]{exec} || $ram[ $off + 1 ]{exec} || $ram[ $off + 2 ]{exec} ) {
+          die "BCD Write to executable memory $off at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ) unless $opts{i};
+        }
+        ram_cell($off)->{write} = 1;
+        $ram[$off]{ram} |= list2vec( 0 .. 2 );
+        ram_cell( $off + 1 )->{write} = 1;
+        $ram[ $off + 1 ]{ram} |= list2vec( 0 .. 9 );
+        ram_cell( $off + 2 )->{write} = 1;
+        $ram[ $off + 2 ]{ram} |= list2vec( 0 .. 9 );
+      }
+    } elsif ( $opL == 0x55 ) {
 
-        # set sound timer - does nothing
-      } elsif ( $opL == 0x1E ) {
+      # store N registers
+      my @offsets = vec2list($i);
 
-        _d( "ADVANCE I BY V[$opB]", $pc, $op, $i, $timer_delay, @v );
+      _d( "STORE v[0] - v[$opB] to I", $pc, $op, $i, $timer_delay, @v );
 
-        # advance I by v[opB]
-        my @result_set;
-        foreach my $j ( vec2list($i) ) {
-          foreach my $b ( vec2list( $v[$opB] ) ) {
-            if ( $j + $b < 4096 ) {
-              push @result_set, ( $j + $b );
-            } else {
-              warn "I + v[$opB] may exceed 4096 at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-            }
+      foreach my $off (@offsets) {
+        for ( my $j = 0 ; $j <= $opB ; $j++ ) {
+          if ( $ram[ $off + $j ]{exec} ) {
+            die "Write to executable memory $off + $j at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ) unless $opts{i};
           }
+          ram_cell( $off + $j )->{write} = 1;
+          $ram[ $off + $j ]{ram} |= $v[$j];
         }
-        $i = list2vec(@result_set);
-      } elsif ( $opL == 0x29 ) {
+      }
+
+      $i = list2vec( map { $_ + $opB + 1 } @offsets );
+    } elsif ( $opL == 0x65 ) {
 
-        _d( "HEX-DIGIT of v[$opB] to I", $pc, $op, $i, $timer_delay, @v );
+      # load N registers
+      my @offsets = vec2list($i);
 
-        if ( !defined $v[$opB] ) {
-          warn "Uninitialized register $opB at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          $v[$opB] = chr(255) x 32;
+      _d( "LOAD v[0] - v[$opB] to I", $pc, $op, $i, $timer_delay, @v );
+
+      for ( my $j = 0 ; $j <= $opB ; $j++ ) {
+        $v[$j] = '';
+        foreach my $off (@offsets) {
+          ram_cell( $off + $j )->{read} = 1;
+          $v[$j] |= $ram[ $off + $j ]{ram};
         }
+      }
 
-        # assign I to a digit - any value 0 to 200 really
-        $i = list2vec( 0 .. 199 );
-      } elsif ( $opL == 0x33 ) {
+      $i = list2vec( map { $_ + $opB + 1 } @offsets );
+    } else {
+      return give_up( $pc, "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op ), $ctx );
+    }
+    $pc += 2;
+  }
 
-        # BCD dump
-        #if ( $i > 4093 ) {
-        #die "I overflow";
-        #}
+  reach( $pc, $ctx, $i, $timer_delay, \@v );
+}
 
-        _d( "BCD of v[$opB] to I", $pc, $op, $i, $timer_delay, @v );
+# analyse from an instruction, with a given state and call stack, until
+#  nothing changes
+sub iterate {
+  my $pc          = shift;
+  my $i           = shift;
+  my $timer_delay = shift;
+  my $v           = shift;
+  my $ctx         = '';
+  $ctx = call( $ctx, $_ ) foreach @_;
+
+  reach( $pc, $ctx, $i, $timer_delay, $v );
+  while (@worklist) {
+    my ( $pc, $ctx ) = @{ pop @worklist };
+    delete $queued{"$pc $ctx"};
+    transfer( $pc, $ctx );
+  }
+}
 
-        foreach my $off ( vec2list($i) ) {
-          if ( $ram[$off]{exec} || $ram[ $off + 1 ]{exec} || $ram[ $off + 2 ]{exec} ) {
-            die "BCD Write to executable memory $off at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-          }
-          $ram[$off]{write} = 1;
-          $ram[$off]{ram} |= list2vec( 0 .. 2 );
-          $ram[ $off + 1 ]{write} = 1;
-          $ram[ $off + 1 ]{ram} |= list2vec( 0 .. 9 );
-          $ram[ $off + 2 ]{write} = 1;
-          $ram[ $off + 2 ]{ram} |= list2vec( 0 .. 9 );
-        }
-      } elsif ( $opL == 0x55 ) {
+# what the analysis has found RAM may hold, and where it is written
+sub ram_sets {
+  return join( ',',
+    map { defined $_ && defined $_->{ram} ? ( $_->{write} ? 'w' : '' ) . unpack( 'H*', vecnorm( $_->{ram} ) ) : '' } @ram );
+}
 
-        # store N registers
-        my @offsets = vec2list($i);
+# analysis rounds, for the timing report
+my $rounds = 0;
+
+# where the interpreter may hand back to native code: the state there is
+#  whatever the interpreter left, so the analysis starts from knowing nothing
+my @entries;
+
+# RAM contents only grow, but a load analysed before a store to the same
+#  place missed what the store puts there: start over until they settle
+sub analyse {
+  my $ram_before;
+  do {
+    $ram_before = ram_sets();
+    delete $_->{exec} foreach grep { defined } @ram;
+    %fallback = %gave_up = %resume = %callers = %returns = ();
+    $rounds++;
+    iterate( 0x200, undef, 0, [ ( list2vec(0) ) x 16 ] );
+    iterate( $_, undef, 255, [ ( chr(255) x 32 ) x 16 ] ) foreach @entries;
+
+    # code written to after it was analysed runs on the interpreter
+    foreach my $pc ( grep { defined $ram[$_] && $ram[$_]{exec} && $ram[$_]{exec}{nibble} == 1 } ( 0x200 .. 4094 ) ) {
+      next unless $ram[$pc]{write} || $ram[ $pc + 1 ]{write};
+      foreach my $stack_str ( grep { $_ ne 'nibble' } keys %{ $ram[$pc]{exec} } ) {
+        give_up( $pc, sprintf( "Self-modifying code at %03x", $pc ), $stack_str );
+      }
+    }
 
-        _d( "STORE v[0] - v[$opB] to I", $pc, $op, $i, $timer_delay, @v );
+    # and the interpreter may store anything anywhere
+    if (%fallback) {
+      $ram[$_]{ram} = chr(255) x 32 foreach ( 0 .. 4095 );
+    }
+  } while ( ram_sets() ne $ram_before );
+
+  # every call on the stacks the analysis gave up with, through the callers
+  #  of truncated contexts too
+  my @todo = keys %gave_up;
+  my %seen;
+  while ( defined( my $ctx = shift @todo ) ) {
+    next if $seen{$ctx}++;
+    $resume{ hex($_) + 2 } = 1 foreach $ctx =~ /(...)/g;
+    push @todo, keys %{ $callers{$ctx} } if length($ctx) == 3 * CONTEXT_DEPTH;
+  }
+}
 
-        foreach my $off (@offsets) {
-          for ( my $j = 0 ; $j <= $opB ; $j++ ) {
-            if ( $ram[ $off + $j ]{exec} ) {
-              die "Write to executable memory $off + $j at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-            }
-            $ram[ $off + $j ]{write} = 1;
-            $ram[ $off + $j ]{ram} |= $v[$opB];
-          }
-        }
+my $started = time;
+analyse();
 
-        $i = list2vec( map { $_ + $opB + 1 } @offsets );
-      } elsif ( $opL == 0x65 ) {
+# native code is entered again where the interpreter returns from a call it
+#  took over in, and at the top level jumps it comes to: analyse from those
+#  too, until there are no new ones
+if (%fallback) {
+  my %entry;
+  while (1) {
+    my @new = grep { !$entry{$_}++ } sort { $a <=> $b } keys %resume;
+    foreach my $pc ( grep { defined $ram[$_] && $ram[$_]{exec} && $ram[$_]{exec}{nibble} == 1 } ( 0x200 .. 4094 ) ) {
+      my $op = ( $ram[$pc]{rom} << 8 ) | $ram[ $pc + 1 ]{rom};
+      next unless ( $op >> 12 ) == 1 && !$fallback{$pc};
+      next if grep { $_ ne 'nibble' && $_ ne '' } keys %{ $ram[$pc]{exec} };
+      push @new, $op & 0x0FFF unless $entry{ $op & 0x0FFF }++;
+    }
+    last unless @new;
+    push @entries, @new;
+    analyse();
+  }
+}
 
-        # load N registers
-        my @offsets = vec2list($i);
+# how long each phase took, with -t
+sub phase {
+  my ( $name, $detail ) = @_;
+  my $now = time;
+  printf STDERR "%-12s %8.3f s%s\n", "$name:", $now - $started, ( defined $detail ? ", $detail" : '' ) if $opts{t};
+  $started = $now;
+}
 
-        _d( "LOAD v[0] - v[$opB] to I", $pc, $op, $i, $timer_delay, @v );
+phase( 'analysis', sprintf( "%d rounds, %d nodes", $rounds, $nodes ) );
 
-        for ( my $j = 0 ; $j <= $opB ; $j++ ) {
-          $v[$j] = '';
-          foreach my $off (@offsets) {
-            $ram[ $off + $j ]{read} = 1;
-            $v[$j] |= $ram[ $off + $j ]{ram};
-          }
-        }
+##### SUBROUTINES
+# A subroutine whose stack discipline is proven becomes a C function: every
+#  instruction of its body runs only inside it (on each stack it was seen
+#  with, the innermost call went to this subroutine), nothing outside jumps
+#  into the body, and it calls only other such subroutines.  Then its 00EE
+#  always returns to the instruction after the call, which C does natively.
+# Everything else stays in run(), calling and returning through a stack of
+#  label addresses (computed goto).
 
-        $i = list2vec( map { $_ + $opB + 1 } @offsets );
-      } else {
-        die "Illegal opcode at " . sprintf( "%03x", $pc ) . ", op = " . sprintf( "%04x", $op );
-      }
-      $pc += 2;
+sub opcode {
+  my $pc = shift;
+  return ( $ram[$pc]{rom} << 8 ) | $ram[ $pc + 1 ]{rom};
+}
+
+sub is_code {
+  my $pc = shift;
+  return defined $ram[$pc] && $ram[$pc]{exec} && $ram[$pc]{exec}{nibble} == 1;
+}
+
+# the subroutine an instruction runs in on a stack: the target of the
+#  innermost call, or -1 at the top level
+sub stack_sub {
+  my $stack_str = shift;
+  return -1 if $stack_str eq '';
+  return opcode( hex substr( $stack_str, -3 ) ) & 0x0FFF;
+}
+
+# where control may go after an instruction, other than into a callee
+sub successors {
+  my $pc  = shift;
+  my $op  = opcode($pc);
+  my $opA = $op >> 12;
+
+  if    ( $op == 0x00EE ) { return () }
+  elsif ( $opA == 1 )     { return ( $op & 0x0FFF ) }
+  elsif ( $opA == 0xB )   { return map { ( $op & 0x0FFF ) + $_ } reg_values( $pc, 0 ) }
+  elsif ( $opA == 3 || $opA == 4 || $opA == 5 || $opA == 9 || $opA == 0xE ) {
+    return ( $pc + 2, $pc + 4 );
+  }
+  return ( $pc + 2 );
+}
+
+my @code = grep { is_code($_) } ( 0x200 .. 4095 );
+
+# the subroutine each instruction runs in, where it is always the same one
+my %owner;
+my %shared;
+my %function;
+foreach my $pc (@code) {
+  my %subs = map { stack_sub($_) => 1 } grep { $_ ne 'nibble' } keys %{ $ram[$pc]{exec} };
+  my @subs = keys %subs;
+  if ( @subs == 1 ) {
+    $owner{$pc} = $subs[0];
+  } else {
+    $shared{$_} = 1 foreach @subs;
+  }
+  my $op = opcode($pc);
+  $function{ $op & 0x0FFF } = 1 if ( $op >> 12 ) == 2;
+}
+delete $function{$_} foreach keys %shared;
+delete $function{$_} foreach grep { $fallback{$_} || !is_code($_) } keys %function;
+
+# drop candidates that break the rules, until none do
+my $changed = 1;
+while ($changed) {
+  $changed = 0;
+  foreach my $pc (@code) {
+    my $sub = $owner{$pc};
+    next unless defined $sub && $function{$sub};
+
+    my $op = opcode($pc);
+    my $ok = !defined $owner{$sub} || $owner{$sub} == $sub;
+
+    # calls stay native all the way down
+    $ok &&= $function{ $op & 0x0FFF } if ( $op >> 12 ) == 2;
+
+    # an infinite loop ends the program, and the interpreter goes on from
+    #  run(), which only run() can do
+    $ok &&= ( $op & 0x0FFF ) != $pc if ( $op >> 12 ) == 1;
+
+    # so does a jump table that misses, or hands over to the interpreter
+    $ok &&= ( () = reg_values( $pc, 0 ) ) <= 1 if ( $op >> 12 ) == 0xB;
+    $ok &&= !$fallback{$pc};
+
+    foreach my $next ( successors($pc) ) {
+      $ok &&= !$fallback{$next};
+      $ok &&= !is_code($next) || ( defined $owner{$next} && $owner{$next} == $sub );
     }
 
+    if ( !$ok ) {
+      delete $function{$sub};
+      $changed = 1;
+    }
   }
 }
 
-iterate( 0x200, undef, 0, [ ( list2vec(0) ) x 16 ] );
+# the C function an instruction goes in: a subroutine, or -1 for run()
+sub placement {
+  my $pc = shift;
+  return ( defined $owner{$pc} && $function{ $owner{$pc} } ) ? $owner{$pc} : -1;
+}
+
+phase('subroutines');
+
+if (%fallback) {
+  print STDERR "Falling back to the interpreter at:\n";
+  printf STDERR " %03x: %s\n", $_, $fallback{$_} foreach sort { $a <=> $b } keys %fallback;
+}
+
+if (DEBUG) {
+  printf( "Native subroutines: %s\n", join( ', ', map { sprintf( '%03x', $_ ) } sort { $a <=> $b } keys %function ) );
+}
 
 # C output
 open my $c, '>', $ARGV[0] . '.c';
 
 print $c "#include \"wrapper.h\"\n";
+print $c "#include \"hybrid.h\"\n" if $opts{i};
 print $c "#include <stdint.h>\n";
-print $c "#include <setjmp.h>\n";
 print $c "#include <stdio.h>\n";
-print $c "#include <stdlib.h>\n\n";
-print $c "uint8_t SCREEN[32][64];\n";
-print $c "uint8_t * i;\n";
-print $c "uint8_t v[16];\n";
-print $c "#define STACK_DEPTH 16\n";
-print $c "jmp_buf stack[STACK_DEPTH];\n";
+print $c "#include <stdlib.h>\n";
+print $c "#include <string.h>\n\n";
+print $c "uint64_t SCREEN[32];\n";
+print $c "uint32_t DIRTY;\n";
+print $c "uint8_t * I;\n";
+print $c "uint8_t V[16];\n";
+if ( $opts{i} ) {
+
+  # RAM and the stack as the interpreter has them, addresses and all
+  print $c "uint8_t RAM[4096];\n";
+  print $c "#define STACK_DEPTH HYBRID_STACK_DEPTH\n";
+  print $c "uint16_t stack[STACK_DEPTH];\n";
+} else {
+  print $c "#define STACK_DEPTH 16\n";
+  print $c "void * stack[STACK_DEPTH];\n";
+}
 print $c "uint8_t sp = 0;\n";
-print $c "uint8_t TIMER_DELAY = 0;\n";
-print $c "uint8_t TIMER_SOUND = 0;\n\n";
+print $c "uint32_t RNG = 1;\n\n";
 
-print $c <<EOF;
+# the instructions that made it into native code
+my @translated = grep { !$fallback{$_} } @code;
+
+# the font is in RAM already for the interpreter
+print $c <<EOF if !$opts{i} && grep { ( opcode($_) & 0xF0FF ) == 0xF029 } @translated;
 static const unsigned char FONT[0x10 * 5] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -737,8 +1083,22 @@ static const unsigned char FONT[0x10 * 5] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-// helper functions
-static const uint8_t plot(uint8_t x, uint8_t y, uint8_t height) {
+EOF
+
+print $c "// helper functions\n";
+print $c <<EOF if grep { ( opcode($_) >> 12 ) == 0xC } @translated;
+// CXNN generator: xorshift32, as in the interpreter
+static uint8_t rnd() {
+  RNG ^= RNG << 13;
+  RNG ^= RNG >> 17;
+  RNG ^= RNG << 5;
+  return RNG >> 24;
+}
+
+EOF
+
+print $c <<EOF if grep { ( opcode($_) >> 12 ) == 0xD } @translated;
+static const uint8_t plot(const uint8_t * i, uint8_t x, uint8_t y, uint8_t height) {
   uint8_t collision = 0;
 
   y %= 32;
@@ -746,32 +1106,39 @@ static const uint8_t plot(uint8_t x, uint8_t y, uint8_t height) {
 
   if (y + height > 32) height = 32 - y;
   for (uint8_t row = 0; row < height; row ++) {
-    uint8_t width = 8;
-    if (x + width > 64) width = 64 - x;
-    for (uint8_t col = 0; col < width; col ++) {
-      if (*(i + row) & (0x80 >> col)) {
-        uint8_t p = ! SCREEN[y + row][x + col];
-        SCREEN[y + row][x + col] = p;
-        screen_set(x + col, y + row, p);
-        if ( ! p) collision = 1;
-      }
-    }
+    // sprite bits past the right edge are shifted out
+    uint64_t sprite = ((uint64_t) *(i + row) << 56) >> x;
+    if (SCREEN[y + row] & sprite) collision = 1;
+    SCREEN[y + row] ^= sprite;
+    if (sprite) DIRTY |= (uint32_t) 1 << (y + row);
   }
 
-  screen_update();
+  screen_update(SCREEN, DIRTY);
+  DIRTY = 0;
 
   return collision;
 }
 
+EOF
+
+print $c <<EOF if grep { opcode($_) == 0x00E0 } @translated;
+// the cleared screen is shown like a sprite, rather than with the next one
 static void clear() {
-  memset(SCREEN, 0, 64 * 32);
-  screen_clear();
+  memset(SCREEN, 0, sizeof(SCREEN));
+  screen_update(SCREEN, 0xFFFFFFFF);
+  DIRTY = 0;
 }
 
 EOF
 
 my $start;
-for ( my $i = 0x200 ; $i < 4096 ; $i++ ) {
+if ( $opts{i} ) {
+
+  # the whole program, for the interpreter to load
+  my @rom = map { $ram[$_]{rom} } grep { defined $ram[$_] && defined $ram[$_]{rom} } ( 0x200 .. 4095 );
+  print $c "static const uint8_t ROM[] = { " . join( ', ', map { sprintf( "0x%02x", $_ ) } @rom ) . " };\n";
+}
+for ( my $i = 0x200 ; !$opts{i} && $i < 4096 ; $i++ ) {
 
   # identify contiguous read / write segments
   if ( $ram[$i]{read} || $ram[$i]{write} ) {
@@ -785,7 +1152,7 @@ for ( my $i = 0x200 ; $i < 4096 ; $i++ ) {
     }
 
     # or advance the endpoint
-    printf $c "0x%02x", $ram[$i]{rom};
+    printf $c "0x%02x", $ram[$i]{rom} // 0;
     $ram[$i]{block}  = $start;
     $ram[$i]{offset} = $i - $start;
   } elsif ( defined $start ) {
@@ -801,128 +1168,425 @@ if ( defined $start ) {
   $start = undef;
 }
 
-print $c "void run() {\n clear();\n";
+##### REGISTERS
+# Registers a function reads live in locals, v0 - vf and i, which the C
+#  compiler can keep in registers; the machine state in V and I holds them
+#  across calls to native subroutines, which load what they read and store
+#  it back on return. Registers a function only writes go to V and I.
+# Where the analysis found a register can hold only one value, reads of it
+#  are folded to that constant, and skips it decides become plain jumps or
+#  nothing at all.
+
+# the registers an instruction uses, as a mask of v0 - vf, with I as bit 16
+sub op_regs {
+  my $op  = shift;
+  my $opA = $op >> 12;
+  my $x   = 1 << ( ( $op >> 8 ) & 0xF );
+  my $y   = 1 << ( ( $op >> 4 ) & 0xF );
+
+  if    ( $opA == 3 || $opA == 4 || $opA == 6 || $opA == 7 || $opA == 0xC || $opA == 0xE ) { return $x }
+  elsif ( $opA == 5 || $opA == 9 ) { return $x | $y }
+  elsif ( $opA == 8 )   { return $x | $y | 0x8000 }
+  elsif ( $opA == 0xA ) { return 0x10000 }
+  elsif ( $opA == 0xB ) { return 0x1 }
+  elsif ( $opA == 0xD ) { return $x | $y | 0x18000 }
+  elsif ( $opA == 0xF ) {
+    my $opL = $op & 0xFF;
+    if    ( $opL == 0x55 || $opL == 0x65 )                 { return ( $x << 1 ) - 1 | 0x10000 }
+    elsif ( $opL == 0x1E || $opL == 0x29 || $opL == 0x33 ) { return $x | 0x10000 }
+    return $x;
+  }
+  return 0;
+}
+
+# the registers each function uses, including those of what it calls
+my %uses;
+$uses{ placement($_) } |= op_regs( opcode($_) ) foreach @code;
+$changed = 1;
+while ($changed) {
+  $changed = 0;
+  foreach my $pc (@code) {
+    my $op = opcode($pc);
+    next unless ( $op >> 12 ) == 2 && $function{ $op & 0x0FFF };
+
+    my $in   = placement($pc);
+    my $uses = $uses{$in} | $uses{ $op & 0x0FFF };
+    if ( $uses != $uses{$in} ) {
+      $uses{$in} = $uses;
+      $changed   = 1;
+    }
+  }
+}
+
+# the functions that make calls of their own, and so may overflow the stack
+my %calls = map { placement($_) => 1 } grep { ( opcode($_) >> 12 ) == 2 } @code;
+
+# whether a skip at an instruction may happen, and whether it may not
+sub skip_cases {
+  my $pc  = shift;
+  my $op  = opcode($pc);
+  my $opA = $op >> 12;
+
+  my @b = reg_values( $pc, ( $op >> 8 ) & 0xF );
+  my ( $equal, $differ );
+  if ( $opA == 3 || $opA == 4 ) {
+    $equal  = grep { $_ == ( $op & 0xFF ) } @b;
+    $differ = grep { $_ != ( $op & 0xFF ) } @b;
+  } else {
+    my @c = reg_values( $pc, ( $op >> 4 ) & 0xF );
+    my %c = map { $_ => 1 } @c;
+    $equal  = grep { $c{$_} } @b;
+    $differ = !( @b == 1 && @c == 1 && $b[0] == $c[0] );
+  }
+  return ( $opA == 3 || $opA == 5 ) ? ( $equal, $differ ) : ( $differ, $equal );
+}
+
+# whether a skip at an instruction is left to a test at run time: with no
+#  values to go on, either may happen
+sub skip_tested {
+  my ( $may_skip, $may_not ) = skip_cases(shift);
+  return !$may_skip == !$may_not;
+}
+
+# the registers an instruction reads as locals, where they are not folded
+sub op_reads {
+  my $pc  = shift;
+  my $op  = opcode($pc);
+  my $opA = $op >> 12;
+  my $opD = $op & 0xF;
+  my $opL = $op & 0xFF;
+
+  my $local = sub {
+    my @values = reg_values( $pc, $_[0] );
+    return @values == 1 ? 0 : 1 << $_[0];
+  };
+  my $x = $local->( ( $op >> 8 ) & 0xF );
+  my $y = $local->( ( $op >> 4 ) & 0xF );
+
+  if    ( $opA == 3 || $opA == 4 ) { return skip_tested($pc) ? $x : 0 }
+  elsif ( $opA == 5 || $opA == 9 ) { return $opD == 0 && skip_tested($pc) ? $x | $y : 0 }
+  elsif ( $opA == 7 || $opA == 0xE ) { return $x }
+  elsif ( $opA == 8 ) {
+    if    ( $opD == 0 || $opD == 6 || $opD == 0xE ) { return $y }
+    elsif ( $opD <= 5 || $opD == 7 ) { return $x | $y }
+  } elsif ( $opA == 0xB ) { return $local->(0) }
+  elsif ( $opA == 0xD ) { return $x | $y | 0x10000 }
+  elsif ( $opA == 0xF ) {
+    if    ( $opL == 0x15 || $opL == 0x18 || $opL == 0x29 ) { return $x }
+    elsif ( $opL == 0x1E || $opL == 0x33 ) { return $x | 0x10000 }
+    elsif ( $opL == 0x55 ) {
+      my $reads = 0x10000;
+      $reads |= $local->($_) foreach ( 0 .. ( $op >> 8 ) & 0xF );
+      return $reads;
+    } elsif ( $opL == 0x65 ) { return 0x10000 }
+  }
+  return 0;
+}
+
+# the registers each function keeps in locals
+my %locals = map { $_ => 0 } ( -1, keys %function );
+$locals{ placement($_) } |= op_reads($_) foreach @code;
+
+# where a write to a register goes in a function: its local, or else
+#  straight to the machine state
+sub lhs {
+  my ( $in, $r ) = @_;
+  return $locals{$in} & 0x10000 ? 'i' : 'I' if $r == 16;
+  return $locals{$in} & ( 1 << $r ) ? sprintf( "v%x", $r ) : sprintf( "V[0x%x]", $r );
+}
+
+# copy the registers in a mask between the locals and the machine state
+sub load_regs {
+  my $mask = shift;
+  return join( ' ', ( map { sprintf( "v%x = V[0x%x];", $_, $_ ) } grep { $mask & ( 1 << $_ ) } ( 0 .. 15 ) ),
+    ( $mask & 0x10000 ? "i = I;" : () ) );
+}
 
-for ( my $i = 0x200 ; $i < 4096 ; $i++ ) {
+sub store_regs {
+  my $mask = shift;
+  return join( ' ', ( map { sprintf( "V[0x%x] = v%x;", $_, $_ ) } grep { $mask & ( 1 << $_ ) } ( 0 .. 15 ) ),
+    ( $mask & 0x10000 ? "I = i;" : () ) );
+}
 
-  # decompile opcodes
+# the values a register may hold at an instruction, on any stack
+sub reg_values {
+  my ( $pc, $r ) = @_;
+  my $set = '';
+  $set |= $ram[$pc]{exec}{$_}{v}[$r] foreach grep { $_ ne 'nibble' } keys %{ $ram[$pc]{exec} };
+  return vec2list($set);
+}
 
-  if ( $ram[$i]{exec} && $ram[$i]{exec}{nibble} == 1 ) {
-    my $op = ( $ram[$i]{rom} << 8 ) | ( $ram[ $i + 1 ]{rom} );
+# a register read at an instruction: its local, or the value it must have
+sub reg {
+  my ( $pc, $r ) = @_;
+  my @values = reg_values( $pc, $r );
+  return @values == 1 ? sprintf( "0x%02x", $values[0] ) : sprintf( "v%x", $r );
+}
 
-    my $opA = ( ( $op & 0xF000 ) >> 12 );
-    my $opB = ( ( $op & 0x0F00 ) >> 8 );
-    my $opC = ( ( $op & 0x00F0 ) >> 4 );
-    my $opD = ( $op & 0x000F );
+# a skip: a test at run time, a plain jump, or nothing at all
+sub skip {
+  my ( $c, $i, $cond ) = @_;
+  my ( $may_skip, $may_not ) = skip_cases($i);
+
+  if ( skip_tested($i) ) {
+    printf $c "if (%s) goto lbl_%03x;\n", $cond, $i + 4;
+  } elsif ($may_skip) {
+    printf $c "goto lbl_%03x;\n", $i + 4;
+  } else {
+    print $c ";\n";
+  }
+}
 
-    my $opL = ( $op & 0x00FF );
+# C code for the instruction at $i, going in function $in
+sub emit {
+  my ( $c, $i, $in ) = @_;
 
-    my $opADDR = ( $op & 0x0FFF );
+  my $op = ( $ram[$i]{rom} << 8 ) | ( $ram[ $i + 1 ]{rom} );
 
-    printf $c "lbl_%03x:\n\t", $i;
-    if ( $opA == 0 ) {
+  my $opA = ( ( $op & 0xF000 ) >> 12 );
+  my $opB = ( ( $op & 0x0F00 ) >> 8 );
+  my $opC = ( ( $op & 0x00F0 ) >> 4 );
+  my $opD = ( $op & 0x000F );
 
-      # call machine routine
-      if ( $opADDR == 0x0E0 ) {
+  my $opL = ( $op & 0x00FF );
 
-        # screen clear - affects nothing
-        print $c "screen_clear(); memset(SCREEN, 0, 64 * 32)\n";
+  my $opADDR = ( $op & 0x0FFF );
 
-      } elsif ( $opADDR == 0xEE ) {
+  # registers as read here, and as written
+  my $vB = reg( $i, $opB );
+  my $vC = reg( $i, $opC );
+  my $wB = lhs( $in, $opB );
+  my $wF = lhs( $in, 0xF );
+  my $wI = lhs( $in, 16 );
 
-        # RET - return the machine state
-        print $c "if (sp == 0) { puts(\"Stack underflow\"); return; } longjmp(stack[sp - 1], 1);\n";
+  printf $c "lbl_%03x:\n\t", $i;
+  if ( $fallback{$i} ) {
+    printf $c "pc = 0x%03x; goto fallback;\n", $i;
+  } elsif ( $opA == 0 ) {
+
+    # call machine routine
+    if ( $opADDR == 0x0E0 ) {
+
+      # screen clear - affects nothing
+      print $c "clear();\n";
+
+    } elsif ( $opADDR == 0xEE ) {
+
+      # RET - back to the caller
+      if ( $in >= 0 ) {
+        print $c join( "\n\t", grep { $_ ne '' } ( store_regs( $locals{$in} ), "return;" ) ) . "\n";
+      } elsif ( $opts{i} ) {
+        print $c "if (sp == 0) { puts(\"Stack underflow\"); return; } pc = stack[-- sp]; goto dispatch;\n";
+      } else {
+        print $c "if (sp == 0) { puts(\"Stack underflow\"); return; } goto *stack[-- sp];\n";
       }
-    } elsif ( $opA == 1 ) {
+    }
+  } elsif ( $opA == 1 ) {
+
+    # infinite loop exits the program instead
+    if ( $i != $opADDR ) {
+      printf $c "goto lbl_%03x;\n", $opADDR;
+    } else {
+      printf $c "return;\n";
+    }
+  } elsif ( $opA == 2 ) {
+    if ( $function{$opADDR} ) {
+
+      # native calls count against the stack too; an overflow below run()
+      #  leaves sp past STACK_DEPTH, for each caller on the way up to return on
+      my $halt = $in >= 0 ? "sp = STACK_DEPTH + 1; return;" : "return;";
+      print $c join(
+        "\n\t",
+        grep { $_ ne '' } (
+          "if (sp == STACK_DEPTH) { puts(\"Stack overflow\"); $halt }",
+          store_regs( $locals{$in} & $uses{$opADDR} ),
+          sprintf( "sp ++; sub_%03x();", $opADDR ),
+          ( $calls{$opADDR} ? "if (sp > STACK_DEPTH) return;" : () ),
+          "sp --;", load_regs( $locals{$in} & $uses{$opADDR} )
+        )
+      ) . "\n";
+    } elsif ( $opts{i} ) {
+      printf $c "if (sp == STACK_DEPTH) { puts(\"Stack overflow\"); return; } stack[sp ++] = 0x%03x; goto lbl_%03x;\n", $i + 2, $opADDR;
+    } else {
+      printf $c "if (sp == STACK_DEPTH) { puts(\"Stack overflow\"); return; } stack[sp ++] = &&ret_%03x; goto lbl_%03x;\nret_%03x:\n", $i, $opADDR, $i;
+    }
+  } elsif ( $opA == 3 || $opA == 4 ) {
+    skip( $c, $i, sprintf( "%s %s 0x%02x", $vB, ( $opA == 3 ? '==' : '!=' ), $opL ) );
+  } elsif ( $opA == 5 || $opA == 9 ) {
+    if ( $opD == 0 ) {
+      skip( $c, $i, sprintf( "%s %s %s", $vB, ( $opA == 5 ? '==' : '!=' ), $vC ) );
+    }
+  } elsif ( $opA == 6 ) {
+    printf $c "%s = 0x%02x;\n", $wB, $opL;
+  } elsif ( $opA == 7 ) {
 
-      # infinite loop exits the program instead
-      if ( $i != $opADDR ) {
-        printf $c "goto lbl_%03x;\n", $opADDR;
+    # a folded sum is worked out here, where it cannot overflow a byte
+    if ( $vB =~ /^0x/ ) {
+      printf $c "%s = 0x%02x;\n", $wB, ( hex($vB) + $opL ) & 0xFF;
+    } else {
+      printf $c "%s = %s + 0x%02x;\n", $wB, $vB, $opL;
+    }
+  } elsif ( $opA == 8 ) {
+    if ( $opD == 0 ) {
+      printf $c "%s = %s;\n", $wB, $vC;
+    } elsif ( $opD == 1 ) {
+      printf $c "%s = %s | %s;\n\t%s = 0;\n", $wB, $vB, $vC, $wF;
+    } elsif ( $opD == 2 ) {
+      printf $c "%s = %s & %s;\n\t%s = 0;\n", $wB, $vB, $vC, $wF;
+    } elsif ( $opD == 3 ) {
+      printf $c "%s = %s ^ %s;\n\t%s = 0;\n", $wB, $vB, $vC, $wF;
+    } elsif ( $opD == 4 ) {
+      printf $c "{ uint16_t result = %s + %s;\n\t%s = result;\n%s = (result > 255 ? 1 : 0);}\n", $vB, $vC, $wB, $wF;
+    } elsif ( $opD == 5 ) {
+      printf $c "{ uint16_t result = %s - %s;\n\t%s = result;\n%s = (result > 255 ? 0 : 1);}\n", $vB, $vC, $wB, $wF;
+    } elsif ( $opD == 6 ) {
+      printf $c "{ uint8_t bit = %s & 1;\n\t%s = %s >> 1;\n%s = bit;}\n", $vC, $wB, $vC, $wF;
+    } elsif ( $opD == 7 ) {
+      printf $c "{ uint16_t result = %s - %s;\n\t%s = result;\n%s = (result > 255 ? 0 : 1);}\n", $vC, $vB, $wB, $wF;
+    } elsif ( $opD == 0xE ) {
+      if ( $vC =~ /^0x/ ) {
+        printf $c "%s = 0x%02x;\n\t%s = %d;\n", $wB, ( hex($vC) << 1 ) & 0xFF, $wF, hex($vC) >> 7;
       } else {
-        printf $c "return;\n";
-      }
-    } elsif ( $opA == 2 ) {
-      printf $c "if (sp == STACK_DEPTH) { puts(\"Stack overflow\"); return; } if (! setjmp(stack[sp])) { sp ++; goto lbl_%03x; } else sp --;\n", $opADDR;
-    } elsif ( $opA == 3 ) {
-      printf $c "if (v[0x%02x] == 0x%02x) goto lbl_%03x;\n", $opB, $opL, $i + 4;
-    } elsif ( $opA == 4 ) {
-      printf $c "if (v[0x%02x] != 0x%02x) goto lbl_%03x;\n", $opB, $opL, $i + 4;
-    } elsif ( $opA == 5 ) {
-      if ( $opD == 0 ) {
-        printf $c "if (v[0x%02x] == v[0x%02x]) goto lbl_%03x;\n", $opB, $opC, $i + 4;
-      }
-    } elsif ( $opA == 6 ) {
-      printf $c "v[0x%02x] = 0x%02x;\n", $opB, $opL;
-    } elsif ( $opA == 7 ) {
-      printf $c "v[0x%02x] += 0x%02x;\n", $opB, $opL;
-    } elsif ( $opA == 8 ) {
-      if ( $opD == 0 ) {
-        printf $c "v[0x%02x] = v[0x%02x];\n", $opB, $opC;
-      } elsif ( $opD == 1 ) {
-        printf $c "v[0x%02x] |= v[0x%02x];\n\tv[0xF] = 0;\n", $opB, $opC;
-      } elsif ( $opD == 2 ) {
-        printf $c "v[0x%02x] &= v[0x%02x];\n\tv[0xF] = 0;\n", $opB, $opC;
-      } elsif ( $opD == 3 ) {
-        printf $c "v[0x%02x] ^= v[0x%02x];\n\tv[0xF] = 0;\n", $opB, $opC;
-      } elsif ( $opD == 4 ) {
-        printf $c "{ uint16_t result = v[0x%02x] + v[0x%02x];\n\tv[0x%02x] = result;\nv[0xF] = (result > 255 ? 1 : 0);}\n", $opB, $opC, $opB;
-      } elsif ( $opD == 5 ) {
-        printf $c "{ uint16_t result = v[0x%02x] - v[0x%02x];\n\tv[0x%02x] = result;\nv[0xF] = (result > 255 ? 0 : 1);}\n", $opB, $opC, $opB;
-      } elsif ( $opD == 6 ) {
-        printf $c "{ uint8_t bit = v[0x%02x] & 1;\n\tv[0x%02x] = v[0x%02x] >> 1;\nv[0xF] = bit;}\n", $opC, $opB, $opC;
-      } elsif ( $opD == 7 ) {
-        printf $c "{ uint16_t result = v[0x%02x] - v[0x%02x];\n\tv[0x%02x] = result;\nv[0xF] = (result > 255 ? 0 : 1);}\n", $opC, $opB, $opB;
-      } elsif ( $opD == 0xE ) {
-        printf $c "{ uint8_t bit = v[0x%02x] >> 7;\n\tv[0x%02x] = v[0x%02x] << 1;\nv[0xF] = bit;}\n", $opC, $opB, $opC;
-      }
-    } elsif ( $opA == 9 ) {
-      if ( $opD == 0 ) {
-        printf $c "if (v[0x%02x] != v[0x%02x]) goto lbl_%03x;\n", $opB, $opC, $i + 4;
-      }
-    } elsif ( $opA == 0xA ) {
-      printf $c "i = ram_%03x + 0x%03x;\n", $ram[$opADDR]{block}, $ram[$opADDR]{offset};
-    } elsif ( $opA == 0xB ) {
-      die "ah";
-    } elsif ( $opA == 0xC ) {
-      printf $c "v[0x%02x] = rand() & 0x%02x;\n", $opB, $opL;
-    } elsif ( $opA == 0xD ) {
-      printf $c "v[0xF] = plot(v[0x%x], v[0x%x], 0x%02x);\n", $opB, $opC, $opD;
-    } elsif ( $opA == 0xE ) {
-      if ( $opL == 0x9E ) {
-        printf $c "if (check_key(v[0x%02x])) goto lbl_%03x;\n", $opB, $i + 4;
-      } elsif ( $opL == 0xA1 ) {
-        printf $c "if (! check_key(v[0x%02x])) goto lbl_%03x;\n", $opB, $i + 4;
-      }
-    } elsif ( $opA == 0xF ) {
-      if ( $opL == 0x07 ) {
-        printf $c "v[0x%02x] = TIMER_DELAY;\n", $opB;
-      } elsif ( $opL == 0x0A ) {
-        printf $c "v[0x%02x] = await_key();\n", $opB;
-      } elsif ( $opL == 0x15 ) {
-        printf $c "TIMER_DELAY = v[0x%02x];\n", $opB;
-      } elsif ( $opL == 0x18 ) {
-        printf $c "TIMER_SOUND = v[0x%02x];\n", $opB;
-      } elsif ( $opL == 0x1E ) {
-        printf $c "i += v[0x%02x];\n", $opB;
-      } elsif ( $opL == 0x29 ) {
-        printf $c "i = & FONT[5 * (v[0x%02x] & 0xF)];\n", $opB;
-      } elsif ( $opL == 0x33 ) {
-        printf $c "{ unsigned char value = v[0x%02x];\n", $opB;
-        printf $c "*(i + 2) = value %% 10; value /= 10;\n";
-        printf $c "*(i + 1) = value %% 10; *i = value / 10;}\n";
-      } elsif ( $opL == 0x55 ) {
-        printf $c "for (unsigned char j = 0; j <= 0x%02x; j ++, i ++)\n", $opB;
-        printf $c "\t\t*i = v[j];\n";
-      } elsif ( $opL == 0x65 ) {
-        printf $c "for (unsigned char j = 0; j <= 0x%02x; j ++, i ++)\n", $opB;
-        printf $c "\t\tv[j] = *i;\n";
+        printf $c "{ uint8_t bit = %s >> 7;\n\t%s = %s << 1;\n%s = bit;}\n", $vC, $wB, $vC, $wF;
       }
     }
+  } elsif ( $opA == 0xA ) {
+    if ( $opts{i} ) {
+      printf $c "%s = RAM + 0x%03x;\n", $wI, $opADDR;
+    } else {
+      printf $c "%s = ram_%03x + 0x%03x;\n", $wI, $ram[$opADDR]{block}, $ram[$opADDR]{offset};
+    }
+  } elsif ( $opA == 0xB ) {
+
+    # jump table over the values v0 may have here
+    my @offsets = reg_values( $i, 0 );
+    if ( @offsets == 1 ) {
+      printf $c "goto lbl_%03x;\n", $opADDR + $offsets[0];
+    } else {
+      print $c "switch (v0) {\n";
+      printf $c "\t\tcase 0x%02x: goto lbl_%03x;\n", $_, $opADDR + $_ foreach @offsets;
+
+      # v0 past what the analysis found: the interpreter goes on from there,
+      #  or the program ends
+      if ( $opts{i} ) {
+        printf $c "\t\tdefault: pc = 0x%03x + v0; goto fallback;\n\t}\n", $opADDR;
+      } else {
+        print $c "\t\tdefault: puts(\"Jump table miss\"); return;\n\t}\n";
+      }
+    }
+  } elsif ( $opA == 0xC ) {
+    printf $c "%s = rnd() & 0x%02x;\n", $wB, $opL;
+  } elsif ( $opA == 0xD ) {
+    printf $c "%s = plot(i, %s, %s, 0x%02x);\n", $wF, $vB, $vC, $opD;
+  } elsif ( $opA == 0xE ) {
+    if ( $opL == 0x9E ) {
+      printf $c "if (check_key(%s)) goto lbl_%03x;\n", $vB, $i + 4;
+    } elsif ( $opL == 0xA1 ) {
+      printf $c "if (! check_key(%s)) goto lbl_%03x;\n", $vB, $i + 4;
+    }
+  } elsif ( $opA == 0xF ) {
+    if ( $opL == 0x07 ) {
+      printf $c "%s = get_timer_delay();\n", $wB;
+    } elsif ( $opL == 0x0A ) {
+      printf $c "%s = await_key();\n", $wB;
+    } elsif ( $opL == 0x15 ) {
+      printf $c "set_timer_delay(%s);\n", $vB;
+    } elsif ( $opL == 0x18 ) {
+      printf $c "set_timer_sound(%s);\n", $vB;
+    } elsif ( $opL == 0x1E ) {
+      printf $c "i += %s;\n", $vB;
+    } elsif ( $opL == 0x29 ) {
+      printf $c "%s = %s[5 * (%s & 0xF)];\n", $wI, ( $opts{i} ? '& RAM' : '(uint8_t *) & FONT' ), $vB;
+    } elsif ( $opL == 0x33 ) {
+      printf $c "{ unsigned char value = %s;\n", $vB;
+      printf $c "*(i + 2) = value %% 10; value /= 10;\n";
+      printf $c "*(i + 1) = value %% 10; *i = value / 10;}\n";
+    } elsif ( $opL == 0x55 ) {
+      printf $c "i[0x%x] = %s; ", $_, reg( $i, $_ ) foreach ( 0 .. $opB );
+      printf $c "i += 0x%02x;\n", $opB + 1;
+    } elsif ( $opL == 0x65 ) {
+      printf $c "%s = i[0x%x]; ", lhs( $in, $_ ), $_ foreach ( 0 .. $opB );
+      printf $c "i += 0x%02x;\n", $opB + 1;
+    }
   }
 }
 
+# the locals of a function, loaded from the machine state
+sub declare_regs {
+  my $mask = shift;
+  return join( '', map { sprintf( " uint8_t v%x = V[0x%x];\n", $_, $_ ) } grep { $mask & ( 1 << $_ ) } ( 0 .. 15 ) )
+    . ( $mask & 0x10000 ? " uint8_t * i = I;\n" : '' );
+}
+
+# each function's code, in address order
+my %body;
+foreach my $i (@code) {
+  my $in = placement($i);
+  open my $fh, '>>', \$body{$in};
+  emit( $fh, $i, $in );
+
+  # the interpreter takes over past the end of the analysed code
+  printf $fh "\tgoto lbl_%03x;\n", $i + 2
+    if $fallback{ $i + 2 } && !is_code( $i + 2 ) && !$fallback{$i} && grep { $_ == $i + 2 } successors($i);
+  close $fh;
+}
+
+# and where the analysis never went in
+foreach my $i ( sort { $a <=> $b } grep { !is_code($_) } keys %fallback ) {
+  $body{-1} .= sprintf( "lbl_%03x:\n\tpc = 0x%03x; goto fallback;\n", $i, $i );
+}
+
+foreach my $sub ( sort { $a <=> $b } keys %function ) {
+  printf $c "static void sub_%03x();\n", $sub;
+}
+print $c "\n";
+
+foreach my $sub ( sort { $a <=> $b } keys %function ) {
+  printf $c "static void sub_%03x() {\n", $sub;
+  print $c declare_regs( $locals{$sub} );
+
+  # the body may start below the entry point
+  printf $c " goto lbl_%03x;\n", $sub if ( grep { placement($_) == $sub } @code )[0] != $sub;
+  print $c $body{$sub};
+  print $c "}\n\n";
+}
+
+print $c "void run() {\n";
+print $c " hybrid_load(ROM, sizeof(ROM));\n uint16_t pc;\n" if $opts{i};
+print $c declare_regs( $locals{-1} );
+print $c " DIRTY = 0xFFFFFFFF;\n";
+print $c $body{-1} if defined $body{-1};
+if ( $opts{i} ) {
+  my $in_run = sub { is_code( $_[0] ) && placement( $_[0] ) == -1 && !$fallback{ $_[0] } };
+
+  # where the interpreter hands back, and where returns in run() go
+  my @entry = grep { $in_run->($_) } @entries;
+  my %return;
+  foreach my $pc ( grep { placement($_) == -1 } @code ) {
+    my $op = opcode($pc);
+    $return{ $pc + 2 } = 1 if ( $op >> 12 ) == 2 && !$function{ $op & 0x0FFF } && $in_run->( $pc + 2 );
+  }
+
+  print $c " return;\n";
+  print $c "fallback:\n";
+  print $c join( '', map { "\t$_\n" } grep { $_ ne '' } store_regs( $locals{-1} ) );
+  print $c "\t{\n\t\tstatic const void * const entries[4096] = {";
+  print $c join( ',', map { sprintf( "\n\t\t\t[0x%03x] = &&lbl_%03x", $_, $_ ) } sort { $a <=> $b } @entry );
+  print $c "\n\t\t};\n";
+  print $c "\t\tpc = hybrid_interpret(pc, entries);\n";
+  print $c "\t\tif (! pc) return;\n";
+  print $c join( '', map { "\t\t$_\n" } grep { $_ ne '' } load_regs( $locals{-1} ) );
+  print $c "\t\tgoto *entries[pc];\n\t}\n";
+  if ( grep { opcode($_) == 0x00EE && !$fallback{$_} } grep { placement($_) == -1 } @code ) {
+    print $c "dispatch:\n";
+    print $c "\tswitch (pc) {\n";
+    printf $c "\t\tcase 0x%03x: goto lbl_%03x;\n", $_, $_ foreach sort { $a <=> $b } keys %return;
+    print $c "\t\tdefault: goto fallback;\n\t}\n";
+  }
+}
 print $c "}\n";
 close $c;
+phase('C output');
 
 # HTML output
 open my $html, '>', "out.html";
@@ -977,4 +1641,5 @@ for ( my $j = 8 ; $j < 64 ; $j++ ) {
 }
 print $html '</table>';
 close $html;
+phase('HTML output');
 
@@ -0,0 +1,208 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+
+// snapshots are handled as whole 64-bit words
+#define WORDS (sizeof(struct chip8_state) / sizeof(uint64_t))
+
+// a recorded frame
+//  a keyframe holds the whole state, any other frame the runs of words
+//  where it differs from its keyframe: a 16-bit count of equal words to
+//  skip, a 16-bit count of words that follow, and those words XOR the
+//  keyframe, repeated (trailing equal words are left out)
+struct frame {
+    unsigned char * data;
+    size_t size;
+    unsigned char key;
+};
+
+struct rewind {
+    struct frame * ring;
+    unsigned int capacity;
+    unsigned int first;     // oldest frame
+    unsigned int count;
+
+    unsigned int interval;
+
+    // the newest keyframe, and the frames recorded from it on
+    uint64_t key[WORDS];
+    unsigned int since_key;
+
+    size_t bytes;
+
+    // room for the longest possible delta
+    unsigned char scratch[WORDS * (sizeof(uint64_t) + 2 * sizeof(uint16_t))];
+};
+
+struct rewind * rewind_create(unsigned int frames, unsigned int interval)
+{
+    struct rewind * rw = malloc(sizeof(struct rewind));
+
+    rw->capacity = (frames ? frames : 1);
+    rw->ring = calloc(rw->capacity, sizeof(struct frame));
+    rw->first = 0;
+    rw->count = 0;
+
+    // dropping a keyframe drops up to interval frames, so keep that to
+    //  half the ring at most
+    rw->interval = (interval ? interval : 1);
+    if (rw->interval > rw->capacity / 2)
+        rw->interval = (rw->capacity / 2 ? rw->capacity / 2 : 1);
+    rw->since_key = 0;
+
+    rw->bytes = 0;
+
+    return rw;
+}
+
+void rewind_destroy(struct rewind * rw)
+{
+    for (unsigned int i = 0; i < rw->count; i ++)
+        free(rw->ring[(rw->first + i) % rw->capacity].data);
+    free(rw->ring);
+    free(rw);
+}
+
+static struct frame * frame_at(struct rewind * rw, unsigned int i)
+{
+    return &rw->ring[(rw->first + i) % rw->capacity];
+}
+
+// make room by dropping the oldest keyframe and the frames that need it
+static void drop_oldest(struct rewind * rw)
+{
+    do {
+        struct frame * f = frame_at(rw, 0);
+        rw->bytes -= f->size;
+        free(f->data);
+        f->data = NULL;
+        rw->first = (rw->first + 1) % rw->capacity;
+        rw->count --;
+    } while (rw->count && ! frame_at(rw, 0)->key);
+
+    if (! rw->count)
+        rw->since_key = 0;
+}
+
+void rewind_push(struct rewind * rw, const struct chip8_state * state)
+{
+    if (rw->count == rw->capacity)
+        drop_oldest(rw);
+
+    uint64_t words[WORDS];
+    memcpy(words, state, sizeof(words));
+
+    struct frame * f = frame_at(rw, rw->count);
+    if (rw->since_key == 0 || rw->since_key >= rw->interval) {
+        f->key = 1;
+        f->size = sizeof(words);
+        f->data = malloc(f->size);
+        memcpy(f->data, words, f->size);
+
+        memcpy(rw->key, words, sizeof(words));
+        rw->since_key = 1;
+    } else {
+        unsigned char * p = rw->scratch;
+        unsigned int w = 0;
+        while (w < WORDS) {
+            uint16_t skip = 0, run = 0;
+            while (w < WORDS && words[w] == rw->key[w]) {
+                w ++;
+                skip ++;
+            }
+            if (w == WORDS) break;
+            unsigned int start = w;
+            while (w < WORDS && words[w] != rw->key[w]) {
+                w ++;
+                run ++;
+            }
+
+            memcpy(p, &skip, sizeof(skip));
+            p += sizeof(skip);
+            memcpy(p, &run, sizeof(run));
+            p += sizeof(run);
+            for (unsigned int i = start; i < w; i ++) {
+                uint64_t delta = words[i] ^ rw->key[i];
+                memcpy(p, &delta, sizeof(delta));
+                p += sizeof(delta);
+            }
+        }
+
+        f->key = 0;
+        f->size = p - rw->scratch;
+        f->data = malloc(f->size ? f->size : 1);
+        memcpy(f->data, rw->scratch, f->size);
+
+        rw->since_key ++;
+    }
+
+    rw->bytes += f->size;
+    rw->count ++;
+}
+
+int rewind_pop(struct rewind * rw, struct chip8_state * state)
+{
+    if (! rw->count)
+        return 1;
+
+    struct frame * f = frame_at(rw, rw->count - 1);
+    uint64_t words[WORDS];
+    if (f->key) {
+        memcpy(words, f->data, sizeof(words));
+    } else {
+        memcpy(words, rw->key, sizeof(words));
+
+        const unsigned char * p = f->data;
+        unsigned int w = 0;
+        while (p < f->data + f->size) {
+            uint16_t skip, run;
+            memcpy(&skip, p, sizeof(skip));
+            p += sizeof(skip);
+            memcpy(&run, p, sizeof(run));
+            p += sizeof(run);
+
+            w += skip;
+            for (; run; run --, w ++) {
+                uint64_t delta;
+                memcpy(&delta, p, sizeof(delta));
+                p += sizeof(delta);
+                words[w] ^= delta;
+            }
+        }
+    }
+    memcpy(state, words, sizeof(words));
+
+    rw->bytes -= f->size;
+    free(f->data);
+    f->data = NULL;
+    rw->count --;
+
+    if (! f->key) {
+        rw->since_key --;
+    } else {
+        // back to the keyframe before, if there still is one
+        rw->since_key = 0;
+        for (unsigned int i = rw->count; i > 0; i --) {
+            struct frame * k = frame_at(rw, i - 1);
+            if (k->key) {
+                memcpy(rw->key, k->data, sizeof(rw->key));
+                rw->since_key = rw->count - (i - 1);
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+unsigned int rewind_frames(const struct rewind * rw)
+{
+    return rw->count;
+}
+
+size_t rewind_bytes(const struct rewind * rw)
+{
+    return rw->bytes + rw->capacity * sizeof(struct frame);
+}
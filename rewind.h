@@ -0,0 +1,33 @@
+#ifndef REWIND_H_
+#define REWIND_H_
+
+#include <stddef.h>
+
+#include "interp.h"
+
+// Rewind history: a ring of machine snapshots, one per frame
+//  every interval-th frame is kept whole (a keyframe), the frames between
+//  only as the words that differ from their keyframe, so a frame where
+//  little happened costs a few bytes
+//  when the ring is full the oldest keyframe goes, with its frames
+
+struct rewind;
+
+// room for frames snapshots, a keyframe every interval of them
+//  (interval is capped at frames / 2, the most a full ring may drop at once)
+struct rewind * rewind_create(unsigned int frames, unsigned int interval);
+
+void rewind_destroy(struct rewind * rw);
+
+// record the newest frame
+void rewind_push(struct rewind * rw, const struct chip8_state * state);
+
+// take back the newest frame, writing it to state
+//  returns 0 if OK or 1 if the history is empty
+int rewind_pop(struct rewind * rw, struct chip8_state * state);
+
+// frames held, and the memory they take
+unsigned int rewind_frames(const struct rewind * rw);
+size_t rewind_bytes(const struct rewind * rw);
+
+#endif
@@ -0,0 +1,95 @@
+#include "script.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int event_cmp(const void * a, const void * b)
+{
+    const struct event * x = a, * y = b;
+    return (x->frame > y->frame) - (x->frame < y->frame);
+}
+
+int script_load(struct script * script, const char * filename)
+{
+    script->events = NULL;
+    script->len = 0;
+
+    FILE * f = fopen(filename, "r");
+    if (! f) {
+        perror(filename);
+        return 1;
+    }
+
+    char line[256];
+    unsigned int size = 0;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long at;
+        unsigned int key, hold = 3;
+        if (line[0] == '#' || sscanf(line, "%lu %x %u", &at, &key, &hold) < 2)
+            continue;
+        if (key > 15) {
+            fprintf(stderr, "%s: bad key %x\n", filename, key);
+            fclose(f);
+            script_free(script);
+            return 1;
+        }
+        if (script->len == size) {
+            size = (size ? size * 2 : 64);
+            script->events = realloc(script->events, size * sizeof(struct event));
+        }
+        script->events[script->len].frame = at;
+        script->events[script->len].key = key;
+        script->events[script->len].hold = hold;
+        script->len ++;
+    }
+    fclose(f);
+
+    qsort(script->events, script->len, sizeof(struct event), event_cmp);
+    return 0;
+}
+
+void script_free(struct script * script)
+{
+    free(script->events);
+    script->events = NULL;
+    script->len = 0;
+}
+
+void input_init(struct input * in, const struct script * script)
+{
+    in->script = script;
+    in->pos = 0;
+    for (int i = 0; i < 16; i ++)
+        in->keys[i] = 0;
+}
+
+void input_poll(struct input * in, unsigned long frame)
+{
+    for (int i = 0; i < 16; i ++) {
+        if (in->keys[i]) in->keys[i] --;
+    }
+
+    if (! in->script) return;
+    while (in->pos < in->script->len && in->script->events[in->pos].frame <= frame) {
+        in->keys[in->script->events[in->pos].key] = in->script->events[in->pos].hold;
+        in->pos ++;
+    }
+}
+
+unsigned char input_next_key(struct input * in)
+{
+    if (in->script && in->pos < in->script->len)
+        return in->script->events[in->pos ++].key;
+    return 0;
+}
+
+uint64_t hash_screen(const uint64_t screen[32])
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char * p = (const unsigned char *) screen;
+    for (int i = 0; i < 32 * 8; i ++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,47 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+#include <stdint.h>
+
+// Scripted input for the headless drivers
+//  a script is a list of key presses: press key at frame, held for hold frames
+
+struct event {
+    unsigned long frame;
+    unsigned char key;
+    unsigned char hold;
+};
+
+struct script {
+    struct event * events;
+    unsigned int len;
+};
+
+// read a script file
+//  one event per line: "frame key [hold]", key in hex, hold defaults to 3
+//  blank lines and lines starting with # are ignored
+//  returns 0 if OK or 1 on error (after printing why)
+int script_load(struct script * script, const char * filename);
+
+void script_free(struct script * script);
+
+// playback of a script, with the same held-key model as the curses frontends
+struct input {
+    const struct script * script;
+    unsigned int pos;
+    unsigned char keys[16];
+};
+
+// script may be NULL for no input at all
+void input_init(struct input * in, const struct script * script);
+
+// age key holds and apply the events due by this frame
+void input_poll(struct input * in, unsigned long frame);
+
+// FX0A: take the next scripted key, whenever it was due (0 when none left)
+unsigned char input_next_key(struct input * in);
+
+// FNV-1a over the packed screen rows
+uint64_t hash_screen(const uint64_t screen[32]);
+
+#endif
@@ -0,0 +1,257 @@
+#include <langinfo.h>
+#include <locale.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "term.h"
+
+// Raw ANSI backend: no screen model besides the last frame shown, which
+//  each draw is diffed against cell by cell; the escape sequences for a
+//  frame collect in one buffer that goes out in a single write()
+
+// glyphs by pixel pair: bit 1 the top pixel, bit 0 the bottom one
+static const char * const blocks[4] = { " ", "\xe2\x96\x84", "\xe2\x96\x80", "\xe2\x96\x88" };
+static const char * const ascii[4] = { " ", ".", "'", ":" };
+
+static const char * const * glyphs = ascii;
+
+// the screen as the terminal has it
+static uint64_t shown[32];
+
+// a cursor move costs more than redrawing a gap this wide
+#define GAP_CELLS 2
+
+// the frame being built, with room for every cell of the screen changed
+//  and a cursor move before each run
+static char out[TERM_ROWS * (TERM_COLS * 3 + (TERM_COLS / (GAP_CELLS + 1) + 1) * 8) + 64];
+static size_t out_len = 0;
+
+static struct termios saved;
+static volatile sig_atomic_t is_open = 0;
+
+// the alternate screen, cleared, with no cursor; then the kitty keyboard
+//  protocol, asking for release events (2) and every key as an escape code
+//  (8, which releases of plain keys need) on top of disambiguation (1),
+//  and a query of what the terminal actually took
+static const char enter_seq[] = "\x1b[?1049h\x1b[?25l\x1b[2J\x1b[>11u\x1b[?u";
+static const char leave_seq[] = "\x1b[<u\x1b[?25h\x1b[?1049l";
+
+// keyboard input: bytes read but not parsed yet (a sequence may be split
+//  across reads), and key events parsed but not returned yet
+static unsigned char in[256];
+static size_t in_len = 0;
+static int parsed[sizeof(in)];
+static unsigned int parsed_pos = 0, parsed_len = 0;
+
+static int releases = 0;
+
+static void write_all(const char * s, size_t n)
+{
+    while (n) {
+        ssize_t w = write(STDOUT_FILENO, s, n);
+        if (w <= 0) return;
+        s += w;
+        n -= w;
+    }
+}
+
+static void put(const char * s, size_t n)
+{
+    // more than a frame between flushes: send what there is
+    if (out_len + n > sizeof(out)) {
+        write_all(out, out_len);
+        out_len = 0;
+    }
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+// give the terminal back on the way out of a signal too
+static void on_signal(int sig)
+{
+    if (is_open) {
+        write(STDOUT_FILENO, leave_seq, sizeof(leave_seq) - 1);
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+    }
+    _exit(128 + sig);
+}
+
+void term_open(void)
+{
+    setlocale(LC_ALL, "");
+    if (! strcmp(nl_langinfo(CODESET), "UTF-8"))
+        glyphs = blocks;
+
+    // no line buffering or echo; signals still come through
+    tcgetattr(STDIN_FILENO, &saved);
+    struct termios raw = saved;
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+    is_open = 1;
+    atexit(term_close);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    write_all(enter_seq, sizeof(enter_seq) - 1);
+    memset(shown, 0, sizeof(shown));
+    out_len = 0;
+}
+
+void term_close(void)
+{
+    if (is_open) {
+        write_all(leave_seq, sizeof(leave_seq) - 1);
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+    }
+    is_open = 0;
+}
+
+void term_draw(const uint64_t screen[32], uint32_t dirty)
+{
+    for (int y = 0; y < TERM_ROWS; y ++) {
+        if (! ((dirty >> (2 * y)) & 3))
+            continue;
+
+        uint64_t top = screen[2 * y], bottom = screen[2 * y + 1];
+        // changed cells, leftmost in the top bit
+        uint64_t changed = (top ^ shown[2 * y]) | (bottom ^ shown[2 * y + 1]);
+        shown[2 * y] = top;
+        shown[2 * y + 1] = bottom;
+
+        int x = 0;
+        while (changed << x) {
+            // skip to the next changed cell and move there
+            x += __builtin_clzll(changed << x);
+            char move[16];
+            put(move, snprintf(move, sizeof(move), "\x1b[%d;%dH", y + 1, x + 1));
+
+            // then redraw up to the end of the run, gaps included while
+            //  they are narrower than a cursor move
+            while (x < TERM_COLS) {
+                uint64_t rest = changed << x;
+                if (! (rest >> 63)) {
+                    int gap = (rest ? __builtin_clzll(rest) : TERM_COLS);
+                    if (gap > GAP_CELLS) break;
+                }
+                const char * g = glyphs[(((top << x) >> 62) & 2) | ((bottom << x) >> 63)];
+                put(g, strlen(g));
+                x ++;
+            }
+            if (x >= TERM_COLS) break;
+        }
+    }
+}
+
+void term_flush(void)
+{
+    write_all(out, out_len);
+    out_len = 0;
+}
+
+void term_beep(void)
+{
+    put("\a", 1);
+}
+
+// a CSI ... u sequence, params being what comes between CSI and the u:
+//  "?flags" answers the query, "code[;mods[:event]]" is a key
+static void csi_u(const unsigned char * params, size_t len)
+{
+    char buf[32];
+    if (len >= sizeof(buf)) return;
+    memcpy(buf, params, len);
+    buf[len] = '\0';
+
+    if (buf[0] == '?') {
+        if (strtoul(buf + 1, NULL, 10) & 2)
+            releases = 1;
+        return;
+    }
+
+    char * end;
+    unsigned long code = strtoul(buf, &end, 10);
+    unsigned long mods = 1, event = 1;
+    // skip alternate key codes
+    while (*end == ':') strtoul(end + 1, &end, 10);
+    if (*end == ';') {
+        mods = strtoul(end + 1, &end, 10);
+        if (*end == ':') event = strtoul(end + 1, &end, 10);
+    }
+
+    // the protocol takes Ctrl-C over from the terminal, so raise it here
+    if (((mods - 1) & 4) && code == 'c' && event != 3) {
+        raise(SIGINT);
+        return;
+    }
+
+    if (event == 3) {
+        releases = 1;
+        parsed[parsed_len ++] = code | TERM_RELEASE;
+    } else {
+        parsed[parsed_len ++] = code;
+    }
+}
+
+// parses one sequence from the n bytes at p
+//  returns the bytes it took, or 0 if it isn't all there yet
+static size_t parse(const unsigned char * p, size_t n)
+{
+    if (p[0] != 0x1b) {
+        parsed[parsed_len ++] = (p[0] == '\b' ? 127 : p[0]);
+        return 1;
+    }
+    if (n < 2) return 0;
+    // Alt-key and the like: drop the escape, keep the key
+    if (p[1] != '[') return 1;
+
+    // CSI: parameters up to a final byte
+    size_t i = 2;
+    while (i < n && (p[i] < 0x40 || p[i] > 0x7E)) i ++;
+    if (i == n)
+        return (n == sizeof(in) ? n : 0);
+    if (p[i] == 'u')
+        csi_u(p + 2, i - 2);
+    return i + 1;
+}
+
+int term_key(int wait)
+{
+    while (parsed_pos == parsed_len) {
+        parsed_pos = parsed_len = 0;
+
+        if (wait) {
+            struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+            poll(&pfd, 1, -1);
+        }
+
+        ssize_t r = read(STDIN_FILENO, in + in_len, sizeof(in) - in_len);
+        if (r <= 0)
+            return -1;
+        in_len += r;
+
+        size_t pos = 0, used;
+        while (pos < in_len && (used = parse(in + pos, in_len - pos)))
+            pos += used;
+        memmove(in, in + pos, in_len - pos);
+        in_len -= pos;
+
+        if (! wait && parsed_pos == parsed_len)
+            return -1;
+    }
+
+    return parsed[parsed_pos ++];
+}
+
+int term_releases(void)
+{
+    return releases;
+}
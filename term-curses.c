@@ -0,0 +1,95 @@
+#include <langinfo.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curses.h>
+
+#include "term.h"
+
+// glyphs by pixel pair: bit 1 the top pixel, bit 0 the bottom one
+static const char * const blocks[4] = { " ", "\xe2\x96\x84", "\xe2\x96\x80", "\xe2\x96\x88" };
+static const char * const ascii[4] = { " ", ".", "'", ":" };
+
+static const char * const * glyphs = ascii;
+
+static int is_open = 0;
+
+void term_open(void)
+{
+    setlocale(LC_ALL, "");
+    if (! strcmp(nl_langinfo(CODESET), "UTF-8"))
+        glyphs = blocks;
+
+    initscr();
+    atexit(term_close);
+    is_open = 1;
+
+    nodelay(stdscr, TRUE);
+    noecho();
+    cbreak();
+
+    intrflush(stdscr, FALSE);
+    keypad(stdscr, TRUE);
+    curs_set(0);
+
+    resizeterm(TERM_ROWS, TERM_COLS);
+}
+
+void term_close(void)
+{
+    if (is_open) {
+        curs_set(1);
+        nocbreak();
+        echo();
+        endwin();
+    }
+    is_open = 0;
+}
+
+void term_draw(const uint64_t screen[32], uint32_t dirty)
+{
+    for (int y = 0; y < TERM_ROWS; y ++) {
+        if (! ((dirty >> (2 * y)) & 3))
+            continue;
+
+        // room for 64 three-byte glyphs
+        char line[TERM_COLS * 3 + 1];
+        char * p = line;
+        uint64_t top = screen[2 * y], bottom = screen[2 * y + 1];
+        for (int x = 0; x < TERM_COLS; x ++) {
+            const char * g = glyphs[((top >> 62) & 2) | (bottom >> 63)];
+            while (*g) *p ++ = *g ++;
+            top <<= 1;
+            bottom <<= 1;
+        }
+        *p = '\0';
+        mvaddstr(y, 0, line);
+    }
+}
+
+void term_flush(void)
+{
+    refresh();
+}
+
+void term_beep(void)
+{
+    beep();
+}
+
+int term_key(int wait)
+{
+    nodelay(stdscr, ! wait);
+    int ch = getch();
+    if (wait) nodelay(stdscr, TRUE);
+
+    if (ch == KEY_BACKSPACE || ch == '\b')
+        return 127;
+    return (ch == ERR ? -1 : ch);
+}
+
+int term_releases(void)
+{
+    // curses only ever sees presses
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef TERM_H_
+#define TERM_H_
+
+#include <stdint.h>
+
+// Terminal backend for curse8 and the recompiled runtime
+//  term-curses.c goes through curses, term-ansi.c writes escape sequences
+//  to the terminal itself; pick one at link time
+//
+// Both draw half-blocks: each terminal cell holds two CHIP-8 pixels, one
+//  above the other, as one of the glyphs ' ', '▀', '▄' or '█' (or ASCII
+//  stand-ins outside a UTF-8 locale), so the 64x32 screen takes 64x16 cells
+
+#define TERM_ROWS 16
+#define TERM_COLS 64
+
+// takes over the terminal; term_close gives it back (safe to call twice,
+//  and registered with atexit)
+void term_open(void);
+void term_close(void);
+
+// draws the rows of screen flagged in dirty (bit N = row N)
+//  each row is 64 pixels, leftmost pixel in the top bit
+void term_draw(const uint64_t screen[32], uint32_t dirty);
+
+// shows everything drawn since the last flush
+void term_flush(void);
+
+void term_beep(void);
+
+// the next key event, or -1 if there is none; with wait, blocks for one
+//  a key is its character, Backspace 127; a release has TERM_RELEASE added
+int term_key(int wait);
+
+#define TERM_RELEASE 0x10000
+
+// nonzero once the terminal is known to report key releases (term-ansi.c,
+//  on terminals with the kitty keyboard protocol); until then every key
+//  event is a press
+int term_releases(void);
+
+#endif
@@ -1,161 +1,218 @@
 #include "wrapper.h"
+#include "term.h"
+#include "keypad.h"
 
 #include <stdlib.h>
 #include <unistd.h>
-#include <curses.h>
 
-#include <signal.h>
-#include <sys/time.h>       /* for setitimer */
+#include <poll.h>
+#include <stdio.h>
+#include <sys/timerfd.h>
 
-// external timers
-extern uint8_t TIMER_DELAY;
-extern uint8_t TIMER_SOUND;
+// 60 Hz frame clock: becomes readable at every frame boundary, and reads
+//  back how many have passed since the last read
+//  all frame work (timers, input) happens synchronously when the program
+//  calls in and the clock has ticked, so nothing runs behind its back
+int frame_clock = -1;
 
-// track key presses
-unsigned char keys[16] = {};
+// by default a sprite only marks its rows, and the screen is shown once per
+//  frame, at the boundary; the program waits for the next frame after
+//  sprite_budget sprites in one (15: a VIP-speed frame can't draw more)
+// with draw_wait (-w), every sprite is shown and then waits for vblank
+int draw_wait = 0;
+unsigned int sprite_budget = 15;
+unsigned int sprites = 0;
 
-// wait-for-vblank-after-refresh
-unsigned int vblank = 0;
-// await-key handler
-unsigned int no_tick = 0;
+// the program's screen, and the rows changed since it was last shown
+const uint64_t * shown = NULL;
+uint32_t pending = 0;
 
-void run();
+// timers
+uint8_t timer_delay = 0;
+uint8_t timer_sound = 0;
 
-//#include <sys/time.h>
+// key state, and the keys down this frame
+struct keypad pad;
+uint32_t keys = 0;
 
-int do_cleanup = 0;
-void endwin_wrapper() {
-    if (do_cleanup) {
-        curs_set(1);
-        nocbreak();
-        echo();
-        endwin();
-    }
-    do_cleanup = 0;
-}
+void run();
 
-unsigned char check_key(unsigned char value) {
-    return keys[value];
+// hex digit for a key, or -1
+static int key_value(int ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'A' && ch <= 'F')
+        return 0xA + ch - 'A';
+    if (ch >= 'a' && ch <= 'f')
+        return 0xA + ch - 'a';
+    return -1;
 }
 
-unsigned char await_key() {
-    no_tick = 1;
+// draw the rows that changed
+static void present()
+{
+    term_draw(shown, pending);
+    pending = 0;
 
-    // clear all current inputs and then wait for a keypress
-    for (int i = 0; i < 16; i ++)
-        keys[i] = 0;
+    term_flush();
+}
 
-    // await_key usually expects to take some time
-    TIMER_DELAY = 0;
-    TIMER_SOUND = 0;
+// run the frames that passed: show the screen, take in key events, and
+//  count down the timers
+static void frames(uint64_t count)
+{
+    if (pending)
+        present();
+    sprites = 0;
 
-    // wait
-    nodelay(stdscr, FALSE);
     int ch;
-    while (1) {
-        ch = getch();
-        if (ch >= '0' && ch <= '9') {
-            ch -= '0';
-            break;
-        }
-        else if (ch >= 'A' && ch <= 'F') {
-            ch = 0xA + ch - 'A';
-            break;
-        } else if (ch >= 'a' && ch <= 'f') {
-            ch = 0xA + ch - 'a';
-            break;
+    while ( (ch = term_key(0)) != -1) {
+        int key = key_value(ch & ~TERM_RELEASE);
+        if (key >= 0)
+            keypad_event(&pad, key, ! (ch & TERM_RELEASE), term_releases());
+    }
+    keys = keypad_frame(&pad);
+    for (uint64_t i = 1; i < count; i ++)
+        keypad_frame(&pad);
+
+    timer_delay = (timer_delay > count ? timer_delay - count : 0);
+    if (timer_sound) {
+        timer_sound = (timer_sound > count ? timer_sound - count : 0);
+        if (timer_sound) {
+            term_beep();
+            term_flush();
         }
     }
-    nodelay(stdscr, TRUE);
-
-    no_tick = 0;
-    return ch;
 }
 
-void screen_set(unsigned char x, unsigned char y, unsigned char set)
+// catch up with the clock, without waiting
+static void poll_frames()
 {
-    mvaddch(y, x, (set ? '#' : ' '));
+    uint64_t count;
+    if (read(frame_clock, &count, sizeof(count)) == sizeof(count))
+        frames(count);
 }
 
-void screen_update()
+// wait for the next frame boundary, then run it
+//  what was drawn is shown first: the program may not call in again soon
+static void wait_frame()
 {
-    refresh();
-    vblank = 1;
-    while (vblank) {
-        usleep(1000);
-    };
+    if (pending)
+        present();
+
+    struct pollfd pfd = { .fd = frame_clock, .events = POLLIN };
+    while (poll(&pfd, 1, -1) < 1)
+        ;
+    poll_frames();
 }
 
-void tick()
-{
-    if (!no_tick) {
-        vblank = 0;
-        //refresh();
+unsigned char check_key(unsigned char value) {
+    poll_frames();
+    return (keys >> value) & 1;
+}
 
-        // collect keyboard input
-        for (int i = 0; i < 16; i ++) {
-            if (keys[i]) keys[i] --;
-        }
+unsigned char await_key() {
+    // wait for a fresh keypress, ignoring keys already down
 
-        // curses doesn't have keydown/keyup
-        //  so instead, we treat every keypress as a 3-frame-long keydown
+    // sleep until a key comes in, keeping the timers running meanwhile
+    struct pollfd pfd[2] = {
+        { .fd = frame_clock, .events = POLLIN },
+        { .fd = STDIN_FILENO, .events = POLLIN },
+    };
+    while (1) {
         int ch;
-        while ( (ch = getch()) != ERR) {
-            if (ch >= '0' && ch <= '9') {
-                keys[ch - '0'] = 3;
-            } else if (ch >= 'A' && ch <= 'F') {
-                keys[0xA + ch - 'A'] = 3;
-            } else if (ch >= 'a' && ch <= 'f') {
-                keys[0xA + ch - 'a'] = 3;
-            }
+        while ( (ch = term_key(0)) != -1) {
+            int key = key_value(ch & ~TERM_RELEASE);
+            if (key < 0) continue;
+            keypad_event(&pad, key, ! (ch & TERM_RELEASE), term_releases());
+            if (! (ch & TERM_RELEASE)) return key;
         }
-        if (TIMER_SOUND) {
-            TIMER_SOUND --;
-            if (TIMER_SOUND)
-                beep();
-        }
-        if (TIMER_DELAY) TIMER_DELAY --;
+
+        poll(pfd, 2, -1);
+        if (pfd[0].revents & POLLIN)
+            poll_frames();
     }
 }
 
-void screen_clear()
-{
-    clear();
+uint8_t get_timer_delay() {
+    poll_frames();
+    return timer_delay;
 }
 
-int main(int argc, char * argv[])
-{
-    initscr();
-    atexit(endwin_wrapper);
-    do_cleanup = 1;
-
-    nodelay(stdscr, TRUE);
-    noecho();
-    cbreak();
+void set_timer_delay(uint8_t value) {
+    poll_frames();
+    timer_delay = value;
+}
 
-    intrflush(stdscr, FALSE);
-    keypad(stdscr, TRUE);
-    curs_set(0);
+void set_timer_sound(uint8_t value) {
+    poll_frames();
+    timer_sound = value;
+}
 
-    resizeterm(32, 64);
+void screen_update(const uint64_t screen[32], uint32_t dirty)
+{
+    shown = screen;
+    pending |= dirty;
+
+    if (draw_wait) {
+        // show it now, then wait for vblank
+        present();
+        wait_frame();
+    } else if (++ sprites >= sprite_budget) {
+        wait_frame();
+    } else {
+        poll_frames();
+    }
+}
 
-    struct itimerval it_val;  /* for setting itimer */
+int main(int argc, char * argv[])
+{
+    // how long a press counts as held where the terminal reports no releases
+    unsigned int hold = 3;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "wb:k:")) != -1) {
+        switch (opt) {
+        case 'w':
+            draw_wait = 1;
+            break;
+        case 'b':
+            sprite_budget = strtoul(optarg, NULL, 0);
+            if (! sprite_budget) sprite_budget = 1;
+            break;
+        case 'k':
+            hold = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-w] [-b sprites-per-frame] [-k hold-frames]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
 
-    if (signal(SIGALRM, (void (*)(int)) tick) == SIG_ERR) {
-        perror("Unable to catch SIGALRM");
+    frame_clock = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (frame_clock == -1) {
+        perror("Unable to create frame clock");
         return EXIT_FAILURE;
     }
-    it_val.it_value.tv_sec = 0;
-    it_val.it_value.tv_usec = 16667;
-    it_val.it_interval = it_val.it_value;
-    if (setitimer(ITIMER_REAL, &it_val, NULL) == -1) {
-        perror("error calling setitimer()");
+    const struct itimerspec frame = {
+        .it_value = { .tv_sec = 0, .tv_nsec = 16666667 },
+        .it_interval = { .tv_sec = 0, .tv_nsec = 16666667 },
+    };
+    if (timerfd_settime(frame_clock, 0, &frame, NULL) == -1) {
+        perror("error calling timerfd_settime()");
         return EXIT_FAILURE;
     }
 
+    keypad_init(&pad, hold);
+    term_open();
+
     run();
 
-    endwin_wrapper();
+    // the last frame's sprites, which no frame boundary got to
+    if (pending)
+        present();
+    term_close();
 
     return 0;
 }
@@ -1,10 +1,18 @@
 #ifndef WRAPPER_H_
 #define WRAPPER_H_ 
 
+#include <stdint.h>
+
 unsigned char check_key(unsigned char value);
 unsigned char await_key();
-void screen_set(unsigned char x, unsigned char y, unsigned char set);
-void screen_update();
-void screen_clear();
+// delay and sound timers, which the wrapper counts down at 60 Hz
+uint8_t get_timer_delay();
+void set_timer_delay(uint8_t value);
+void set_timer_sound(uint8_t value);
+// called after every sprite with the rows of screen flagged in dirty (bit N = row N)
+//  the runtime shows them and paces the program: at the next frame boundary, or
+//  at once and waiting for vblank
+//  each row is 64 pixels, leftmost pixel in the top bit
+void screen_update(const uint64_t screen[32], uint32_t dirty);
 
 #endif